@@ -70,6 +70,14 @@ typedef unsigned int  dsk_pcyl_t;	/* Physical cylinder */
 typedef unsigned int  dsk_phead_t;	/* Physical head */
 typedef unsigned char dsk_gap_t;	/* Gap length */
 typedef const char *  dsk_cchar_t;	/* Const char * */
+/* Byte offset in an image file; 64-bit where the compiler allows it, so
+ * that hard drive images over 4Gb can be addressed */
+#if defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1400) || \
+    (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+typedef unsigned long long dsk_offset_t;
+#else
+typedef unsigned long dsk_offset_t;
+#endif
 #define DSK_ERR_OK	 (0)	/* No error */
 #define DSK_ERR_BADPTR	 (-1)	/* Bad pointer */
 #define DSK_ERR_DIVZERO  (-2)	/* Division by zero */
@@ -345,6 +353,14 @@ LDPUBLIC32 dsk_err_t  LDPUBLIC16 dsk_xwrite(DSK_PDRIVER self, const DSK_GEOMETRY
 			      dsk_psect_t sector, size_t sector_len,
 			      int deleted);
 
+/* Read / write a run of consecutive logical sectors. Drivers with a linear
+ * image layout serve the whole run at once; for the others this is the 
+ * same as calling dsk_lread() / dsk_lwrite() for each sector. */
+LDPUBLIC32 dsk_err_t  LDPUBLIC16 dsk_lread_multi(DSK_PDRIVER self, const DSK_GEOMETRY *geom,
+                              void *buf, dsk_lsect_t sector, unsigned count);
+LDPUBLIC32 dsk_err_t  LDPUBLIC16 dsk_lwrite_multi(DSK_PDRIVER self, const DSK_GEOMETRY *geom,
+                              const void *buf, dsk_lsect_t sector, unsigned count);
+
 /* Verify sector against memory buffer. There are three alternative versions:
  *  One that uses physical sectors
  *  One that uses logical sectors
@@ -473,6 +489,12 @@ LDPUBLIC32 dsk_err_t  LDPUBLIC16 dsk_get_comment(DSK_PDRIVER self, char **commen
 LDPUBLIC32 dsk_err_t LDPUBLIC16 dsk_set_retry(DSK_PDRIVER self, unsigned int count);
 LDPUBLIC32 dsk_err_t LDPUBLIC16 dsk_get_retry(DSK_PDRIVER self, unsigned int *count);
 
+/* Make the image start at the given byte offset in the underlying file,
+ * so that a partition can be used without extracting it. Must be called
+ * before the geometry is probed. Returns DSK_ERR_NOTIMPL if the driver 
+ * has no notion of file offsets. */
+LDPUBLIC32 dsk_err_t LDPUBLIC16 dsk_set_offset(DSK_PDRIVER self, dsk_offset_t offset);
+
 /* Get the driver name and description */
 LDPUBLIC32 const char * LDPUBLIC16 dsk_drvname(DSK_PDRIVER self);
 LDPUBLIC32 const char * LDPUBLIC16 dsk_drvdesc(DSK_PDRIVER self);
@@ -159,6 +159,19 @@ typedef struct drv_class
 
 	/* Convert from LDBS format. */
 	dsk_err_t (*dc_from_ldbs)(DSK_DRIVER *self, struct ldbs *source, DSK_GEOMETRY *geom);
+
+	/* Read / write a run of consecutive logical sectors in one go. Only
+	 * provide these if the image layout lets you do better than one 
+	 * dc_read / dc_write per sector. Return DSK_ERR_NOTIMPL to fall back
+	 * to the per-sector functions for a given geometry. */
+	dsk_err_t (*dc_lread_multi)(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+			      void *buf, dsk_lsect_t sector, unsigned count);
+	dsk_err_t (*dc_lwrite_multi)(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+			      const void *buf, dsk_lsect_t sector, unsigned count);
+
+	/* Make the image appear to start at a byte offset in the file, for
+	 * example to access one partition of a hard drive image in place. */
+	dsk_err_t (*dc_set_offset)(DSK_DRIVER *self, dsk_offset_t offset);
 } DRV_CLASS;
 
 /* Returns true of drv is an instance of dc. That is, either its driver class
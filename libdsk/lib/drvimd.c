@@ -385,6 +385,7 @@ dsk_err_t imd_open(DSK_DRIVER *self, const char *filename)
 	dsk_ltrack_t count = 0;
 	char *comment, *ucomment;
 	int termch;
+	char magic[4];
 
 	/* Sanity check: Is this meant for our driver? */
 	if (self->dr_class != &dc_imd) return DSK_ERR_BADPTR;
@@ -398,6 +399,15 @@ dsk_err_t imd_open(DSK_DRIVER *self, const char *filename)
 	}
 	if (!fp) return DSK_ERR_NOTME;
 
+	/* Check the 4-byte magic before looking for the end of the first
+	 * line: on a large raw image that line could be gigabytes long */
+	if (fread(magic, 1, 4, fp) < 4 || memcmp(magic, "IMD ", 4) ||
+	    fseek(fp, 0, SEEK_SET))
+	{
+		fclose(fp);
+		return DSK_ERR_NOTME;
+	}
+
 	/* Try to check the magic number. Read the first line, which
  	 * may terminate with '\n' if a comment follows, or 0x1A 
 	 * otherwise. */
@@ -24,6 +24,11 @@
  * sides laid out in the order specified by the disk geometry. What you end
  * up with is a logical filesystem image, hence the name. */
 
+/* Hard drive images can be bigger than 2Gb: ask for a 64-bit off_t */
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <stdio.h>
 #include "libdsk.h"
 #include "ldbs.h"
@@ -60,9 +65,46 @@ DRV_CLASS dc_logical =
 	NULL,		/* trackids */
 	NULL,		/* rtread */
 	logical_to_ldbs,	/* export as LDBS */
-	logical_from_ldbs	/* import as LDBS */
+	logical_from_ldbs,	/* import as LDBS */
+	logical_lread_multi,	/* read a run of logical sectors */
+	logical_lwrite_multi,	/* write a run of logical sectors */
+	logical_set_offset	/* start of the image in the file */
 };
 
+/* Seek to an absolute position using 64-bit offsets where the platform 
+ * has fseeko(), as the posix driver does. Positions that don't fit are
+ * reported as failures rather than silently wrapping around. */
+static int logical_seek(FILE *fp, dsk_offset_t offset)
+{
+#if defined(HAVE_UNISTD_H) && !defined(_WIN32)
+	if (offset != (dsk_offset_t)(off_t)offset || (off_t)offset < 0) 
+		return -1;
+	return fseeko(fp, (off_t)offset, SEEK_SET);
+#else
+	if (offset != (dsk_offset_t)(long)offset || (long)offset < 0) 
+		return -1;
+	return fseek(fp, (long)offset, SEEK_SET);
+#endif
+}
+
+static dsk_err_t logical_filesize(FILE *fp, dsk_offset_t *size)
+{
+#if defined(HAVE_UNISTD_H) && !defined(_WIN32)
+	off_t pos;
+
+	if (fseeko(fp, 0, SEEK_END)) return DSK_ERR_SYSERR;
+	pos = ftello(fp);
+#else
+	long pos;
+
+	if (fseek(fp, 0, SEEK_END)) return DSK_ERR_SYSERR;
+	pos = ftell(fp);
+#endif
+	if (pos < 0) return DSK_ERR_SYSERR;
+	*size = (dsk_offset_t)pos;
+	return DSK_ERR_OK;
+}
+
 dsk_err_t logical_open(DSK_DRIVER *self, const char *filename)
 {
 	LOGICAL_DSK_DRIVER *lpxself;
@@ -82,10 +124,7 @@ dsk_err_t logical_open(DSK_DRIVER *self, const char *filename)
  * of the file. Under Windows, writing off the end of the file fills the 
  * gaps with random data, which can cause mess to appear in the directory;
  * and under UNIX, the entire directory is filled with zeroes. */
-        if (fseek(lpxself->lpx_fp, 0, SEEK_END)) return DSK_ERR_SYSERR;
-        lpxself->lpx_filesize = ftell(lpxself->lpx_fp);
-
-	return DSK_ERR_OK;
+        return logical_filesize(lpxself->lpx_fp, &lpxself->lpx_filesize);
 }
 
 
@@ -126,7 +165,8 @@ dsk_err_t logical_read(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                               dsk_phead_t head, dsk_psect_t sector)
 {
 	LOGICAL_DSK_DRIVER *lpxself;
-	dsk_lsect_t offset;
+	dsk_lsect_t lsect;
+	dsk_offset_t offset;
 	dsk_err_t err;
 
 	if (!buf || !self || !geom || self->dr_class != &dc_logical) return DSK_ERR_BADPTR;
@@ -134,11 +174,12 @@ dsk_err_t logical_read(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 
 	if (!lpxself->lpx_fp) return DSK_ERR_NOTRDY;
 
-	err = dg_ps2ls(geom, cylinder, head, sector, &offset);
+	err = dg_ps2ls(geom, cylinder, head, sector, &lsect);
 	if (err) return err;
-	offset *=  geom->dg_secsize;
+	offset = (dsk_offset_t)lsect * geom->dg_secsize;
+	offset += lpxself->lpx_base;
 
-	if (fseek(lpxself->lpx_fp, offset, SEEK_SET)) return DSK_ERR_SYSERR;
+	if (logical_seek(lpxself->lpx_fp, offset)) return DSK_ERR_SYSERR;
 
 	if (fread(buf, 1, geom->dg_secsize, lpxself->lpx_fp) < geom->dg_secsize)
 	{
@@ -148,21 +189,21 @@ dsk_err_t logical_read(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 }
 
 
-static dsk_err_t seekto(LOGICAL_DSK_DRIVER *self, unsigned long offset)
+static dsk_err_t seekto(LOGICAL_DSK_DRIVER *self, dsk_offset_t offset)
 {
 	/* 0.9.5: Fill any "holes" in the file with 0xE5. Otherwise, UNIX would
 	 * fill them with zeroes and Windows would fill them with whatever
 	 * happened to be lying around */
 	if (self->lpx_filesize < offset)
 	{
-		if (fseek(self->lpx_fp, self->lpx_filesize, SEEK_SET)) return DSK_ERR_SYSERR;
+		if (logical_seek(self->lpx_fp, self->lpx_filesize)) return DSK_ERR_SYSERR;
 		while (self->lpx_filesize < offset)
 		{
 			if (fputc(0xE5, self->lpx_fp) == EOF) return DSK_ERR_SYSERR;
 			++self->lpx_filesize;
 		}
 	}
-	if (fseek(self->lpx_fp, offset, SEEK_SET)) return DSK_ERR_SYSERR;
+	if (logical_seek(self->lpx_fp, offset)) return DSK_ERR_SYSERR;
 	return DSK_ERR_OK;
 }
 
@@ -171,7 +212,8 @@ dsk_err_t logical_write(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                               dsk_phead_t head, dsk_psect_t sector)
 {
 	LOGICAL_DSK_DRIVER *lpxself;
-	dsk_lsect_t offset;
+	dsk_lsect_t lsect;
+	dsk_offset_t offset;
 	dsk_err_t err;
 
 	if (!buf || !self || !geom || self->dr_class != &dc_logical) return DSK_ERR_BADPTR;
@@ -180,9 +222,10 @@ dsk_err_t logical_write(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 	if (!lpxself->lpx_fp) return DSK_ERR_NOTRDY;
 	if (lpxself->lpx_readonly) return DSK_ERR_RDONLY;
 
-	err = dg_ps2ls(geom, cylinder, head, sector, &offset);
+	err = dg_ps2ls(geom, cylinder, head, sector, &lsect);
 	if (err) return err;
-	offset *=  geom->dg_secsize;
+	offset = (dsk_offset_t)lsect * geom->dg_secsize;
+	offset += lpxself->lpx_base;
 
 	err = seekto(lpxself, offset);
 	if (err) return err;
@@ -197,6 +240,83 @@ dsk_err_t logical_write(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 }
 
 
+/* Logical sectors are stored in order, so a run of them is a single
+ * block of the file. Check that the whole run is on the disc. */
+static dsk_err_t logical_runcheck(const DSK_GEOMETRY *geom, 
+				dsk_lsect_t sector, unsigned count)
+{
+	dsk_pcyl_t cylinder;
+	dsk_phead_t head;
+	dsk_psect_t psect;
+	dsk_err_t err;
+
+	if (!count) return DSK_ERR_BADPARM;
+	err = dg_ls2ps(geom, sector, &cylinder, &head, &psect);
+	if (err) return err;
+	return dg_ls2ps(geom, sector + count - 1, &cylinder, &head, &psect);
+}
+
+dsk_err_t logical_lread_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+			void *buf, dsk_lsect_t sector, unsigned count)
+{
+	LOGICAL_DSK_DRIVER *lpxself;
+	dsk_offset_t offset;
+	unsigned long len;
+	dsk_err_t err;
+
+	if (!buf || !self || !geom || self->dr_class != &dc_logical) return DSK_ERR_BADPTR;
+	lpxself = (LOGICAL_DSK_DRIVER *)self;
+
+	if (!lpxself->lpx_fp) return DSK_ERR_NOTRDY;
+
+	err = logical_runcheck(geom, sector, count);
+	if (err) return err;
+	offset = (dsk_offset_t)sector * geom->dg_secsize;
+	offset += lpxself->lpx_base;
+	len = (unsigned long)count * geom->dg_secsize;
+
+	if (logical_seek(lpxself->lpx_fp, offset)) return DSK_ERR_SYSERR;
+
+	if (fread(buf, 1, len, lpxself->lpx_fp) < len)
+	{
+		return DSK_ERR_NOADDR;
+	}
+	return DSK_ERR_OK;
+}
+
+dsk_err_t logical_lwrite_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+			const void *buf, dsk_lsect_t sector, unsigned count)
+{
+	LOGICAL_DSK_DRIVER *lpxself;
+	dsk_offset_t offset;
+	unsigned long len;
+	dsk_err_t err;
+
+	if (!buf || !self || !geom || self->dr_class != &dc_logical) return DSK_ERR_BADPTR;
+	lpxself = (LOGICAL_DSK_DRIVER *)self;
+
+	if (!lpxself->lpx_fp) return DSK_ERR_NOTRDY;
+	if (lpxself->lpx_readonly) return DSK_ERR_RDONLY;
+
+	err = logical_runcheck(geom, sector, count);
+	if (err) return err;
+	offset = (dsk_offset_t)sector * geom->dg_secsize;
+	offset += lpxself->lpx_base;
+	len = (unsigned long)count * geom->dg_secsize;
+
+	err = seekto(lpxself, offset);
+	if (err) return err;
+
+	if (fwrite(buf, 1, len, lpxself->lpx_fp) < len)
+	{
+		return DSK_ERR_NOADDR;
+	}
+	if (lpxself->lpx_filesize < offset + len)
+		lpxself->lpx_filesize = offset + len;
+	return DSK_ERR_OK;
+}
+
+
 dsk_err_t logical_format(DSK_DRIVER *self, DSK_GEOMETRY *geom,
                                 dsk_pcyl_t cylinder, dsk_phead_t head,
                                 const DSK_FORMAT *format, unsigned char filler)
@@ -206,7 +326,8 @@ dsk_err_t logical_format(DSK_DRIVER *self, DSK_GEOMETRY *geom,
  * images don't hold track headers.
  */
 	LOGICAL_DSK_DRIVER *lpxself;
-	dsk_lsect_t offset;
+	dsk_lsect_t lsect;
+	dsk_offset_t offset;
 	unsigned long trklen;
 	dsk_err_t err;
 
@@ -219,9 +340,10 @@ dsk_err_t logical_format(DSK_DRIVER *self, DSK_GEOMETRY *geom,
 
 	trklen = geom->dg_sectors * geom->dg_secsize;
 
-	err = dg_ps2ls(geom, cylinder, head, geom->dg_secbase, &offset);
+	err = dg_ps2ls(geom, cylinder, head, geom->dg_secbase, &lsect);
 	if (err) return err;
-	offset *= geom->dg_secsize;
+	offset = (dsk_offset_t)lsect * geom->dg_secsize;
+	offset += lpxself->lpx_base;
 
 	err = seekto(lpxself, offset);
 	if (err) return err;
@@ -241,7 +363,8 @@ dsk_err_t logical_xseek(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 {
 	LOGICAL_DSK_DRIVER *lpxself;
 	dsk_err_t err;
-	dsk_lsect_t offset;
+	dsk_lsect_t lsect;
+	dsk_offset_t offset;
 
 	if (!self || !geom || self->dr_class != &dc_logical) return DSK_ERR_BADPTR;
 	lpxself = (LOGICAL_DSK_DRIVER *)self;
@@ -251,15 +374,27 @@ dsk_err_t logical_xseek(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 	if (cylinder >= geom->dg_cylinders || head >= geom->dg_heads)
 		return DSK_ERR_SEEKFAIL;
 
-	err = dg_ps2ls(geom, cylinder, head, geom->dg_secbase, &offset);
+	err = dg_ps2ls(geom, cylinder, head, geom->dg_secbase, &lsect);
 	if (err) return err;
-	offset *= geom->dg_secsize;
+	offset = (dsk_offset_t)lsect * geom->dg_secsize;
+	offset += lpxself->lpx_base;
 	
-	if (fseek(lpxself->lpx_fp, offset, SEEK_SET)) return DSK_ERR_SEEKFAIL;
+	if (logical_seek(lpxself->lpx_fp, offset)) return DSK_ERR_SEEKFAIL;
 
 	return DSK_ERR_OK;
 }
 
+dsk_err_t logical_set_offset(DSK_DRIVER *self, dsk_offset_t offset)
+{
+	LOGICAL_DSK_DRIVER *lpxself;
+
+	if (!self || self->dr_class != &dc_logical) return DSK_ERR_BADPTR;
+	lpxself = (LOGICAL_DSK_DRIVER *)self;
+
+	lpxself->lpx_base = offset;
+	return DSK_ERR_OK;
+}
+
 dsk_err_t logical_status(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                       dsk_phead_t head, unsigned char *result)
 {
@@ -429,7 +564,7 @@ static dsk_err_t logical_from_ldbs_callback(PLDBS ldbs, dsk_pcyl_t cyl,
 dsk_err_t logical_from_ldbs(DSK_DRIVER *self, struct ldbs *source, DSK_GEOMETRY *geom)
 {
 	LOGICAL_DSK_DRIVER *lpxself;
-	long pos;
+	dsk_offset_t pos;
 	dsk_err_t err;
 
 	if (!self || !source || self->dr_class != &dc_logical) return DSK_ERR_BADPTR;
@@ -446,7 +581,7 @@ dsk_err_t logical_from_ldbs(DSK_DRIVER *self, struct ldbs *source, DSK_GEOMETRY
 	/* Erase anything existing in the file */
 	if (fseek(lpxself->lpx_fp, 0, SEEK_SET)) return DSK_ERR_SYSERR;
 
-	for (pos = 0; pos < (long)(lpxself->lpx_filesize); pos++)
+	for (pos = 0; pos < lpxself->lpx_filesize; pos++)
 	{
 		if (fputc(0xE5, lpxself->lpx_fp) == EOF) return DSK_ERR_SYSERR;
 	}
@@ -27,7 +27,8 @@ typedef struct
         DSK_DRIVER lpx_super;
         FILE *lpx_fp;
 	int   lpx_readonly;
-	unsigned long  lpx_filesize;
+	dsk_offset_t   lpx_filesize;
+	dsk_offset_t lpx_base;	/* Where the image starts in the file */
 /* Used only when importing an LDBS file */
 	DSK_GEOMETRY *lpx_export_geom;
 	unsigned char *lpx_secbuf;
@@ -42,11 +43,16 @@ dsk_err_t logical_read(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 dsk_err_t logical_write(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                               const void *buf, dsk_pcyl_t cylinder,
                               dsk_phead_t head, dsk_psect_t sector);
+dsk_err_t logical_lread_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+                              void *buf, dsk_lsect_t sector, unsigned count);
+dsk_err_t logical_lwrite_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+                              const void *buf, dsk_lsect_t sector, unsigned count);
 dsk_err_t logical_format(DSK_DRIVER *self, DSK_GEOMETRY *geom,
                                 dsk_pcyl_t cylinder, dsk_phead_t head,
                                 const DSK_FORMAT *format, unsigned char filler);
 dsk_err_t logical_xseek(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                                 dsk_pcyl_t cylinder, dsk_phead_t head);
+dsk_err_t logical_set_offset(DSK_DRIVER *self, dsk_offset_t offset);
 dsk_err_t logical_status(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                                 dsk_phead_t head, unsigned char *result);
 dsk_err_t logical_to_ldbs(DSK_DRIVER *self, struct ldbs **result, DSK_GEOMETRY *geom);
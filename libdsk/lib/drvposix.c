@@ -23,6 +23,11 @@
 /* This driver is the most basic of the drivers, and simply implements 
  * access to a flat file with the tracks laid out in the SIDES_ALT order */
 
+/* Hard drive images can be bigger than 2Gb: ask for a 64-bit off_t */
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <stdio.h>
 #include <assert.h>
 #include "libdsk.h"
@@ -59,7 +64,10 @@ DRV_CLASS dc_posixalt =
 	NULL,		/* trackids */
 	NULL,		/* rtread */
 	posix_to_ldbs,	/* export as LDBS */
-	posix_from_ldbs	/* import as LDBS */
+	posix_from_ldbs,	/* import as LDBS */
+	posix_lread_multi,	/* read a run of logical sectors */
+	posix_lwrite_multi,	/* write a run of logical sectors */
+	posix_set_offset	/* start of the image in the file */
 };
 
 DRV_CLASS dc_posixoo = 
@@ -88,7 +96,10 @@ DRV_CLASS dc_posixoo =
 	NULL,		/* trackids */
 	NULL,		/* rtread */
 	posix_to_ldbs,	/* export as LDBS */
-	posix_from_ldbs	/* import as LDBS */
+	posix_from_ldbs,	/* import as LDBS */
+	posix_lread_multi,	/* read a run of logical sectors */
+	posix_lwrite_multi,	/* write a run of logical sectors */
+	posix_set_offset	/* start of the image in the file */
 };
 
 DRV_CLASS dc_posixob = 
@@ -117,9 +128,46 @@ DRV_CLASS dc_posixob =
 	NULL,		/* trackids */
 	NULL,		/* rtread */
 	posix_to_ldbs,	/* export as LDBS */
-	posix_from_ldbs	/* import as LDBS */
+	posix_from_ldbs,	/* import as LDBS */
+	posix_lread_multi,	/* read a run of logical sectors */
+	posix_lwrite_multi,	/* write a run of logical sectors */
+	posix_set_offset	/* start of the image in the file */
 };
 
+/* Seek to an absolute position using 64-bit offsets where the platform 
+ * has fseeko(). Positions that don't fit are reported as failures rather
+ * than silently wrapping around. */
+static int posix_seek(FILE *fp, dsk_offset_t offset)
+{
+#if defined(HAVE_UNISTD_H) && !defined(_WIN32)
+	if (offset != (dsk_offset_t)(off_t)offset || (off_t)offset < 0) 
+		return -1;
+	return fseeko(fp, (off_t)offset, SEEK_SET);
+#else
+	if (offset != (dsk_offset_t)(long)offset || (long)offset < 0) 
+		return -1;
+	return fseek(fp, (long)offset, SEEK_SET);
+#endif
+}
+
+static dsk_err_t posix_filesize(FILE *fp, dsk_offset_t *size)
+{
+#if defined(HAVE_UNISTD_H) && !defined(_WIN32)
+	off_t pos;
+
+	if (fseeko(fp, 0, SEEK_END)) return DSK_ERR_SYSERR;
+	pos = ftello(fp);
+#else
+	long pos;
+
+	if (fseek(fp, 0, SEEK_END)) return DSK_ERR_SYSERR;
+	pos = ftell(fp);
+#endif
+	if (pos < 0) return DSK_ERR_SYSERR;
+	*size = (dsk_offset_t)pos;
+	return DSK_ERR_OK;
+}
+
 #define CHECK_CLASS(s) \
 	if (s->dr_class != &dc_posixalt && \
 	    s->dr_class != &dc_posixoo  && \
@@ -148,10 +196,7 @@ dsk_err_t posix_open(DSK_DRIVER *self, const char *filename, dsk_sides_t s)
  * of the file. Under Windows, writing off the end of the file fills the 
  * gaps with random data, which can cause mess to appear in the directory;
  * and under UNIX, the entire directory is filled with zeroes. */
-        if (fseek(pxself->px_fp, 0, SEEK_END)) return DSK_ERR_SYSERR;
-        pxself->px_filesize = ftell(pxself->px_fp);
-
-	return DSK_ERR_OK;
+        return posix_filesize(pxself->px_fp, &pxself->px_filesize);
 }
 
 
@@ -216,11 +261,11 @@ dsk_err_t posix_close(DSK_DRIVER *self)
 }
 
 
-unsigned long posix_offset(POSIX_DSK_DRIVER *pxself, const DSK_GEOMETRY *geom,
+dsk_offset_t posix_offset(POSIX_DSK_DRIVER *pxself, const DSK_GEOMETRY *geom,
 			dsk_pcyl_t cylinder, dsk_phead_t head, 
 			dsk_psect_t sector)
 {
-	unsigned long offset = 0;
+	dsk_offset_t offset = 0;
 
 	/* Work out the offset based on the sidedness of the disk image
 	 * (not the sidedness of the geometry) */
@@ -228,12 +273,12 @@ unsigned long posix_offset(POSIX_DSK_DRIVER *pxself, const DSK_GEOMETRY *geom,
 	{
 		case SIDES_EXTSURFACE:
 		case SIDES_ALT:
-			offset = (cylinder * geom->dg_heads) + head;
+			offset = ((dsk_offset_t)cylinder * geom->dg_heads) + head;
 			break;
 		case SIDES_OUTBACK:
 			if (head)
 			{
-				offset = (2 * geom->dg_cylinders - 1 - cylinder);
+				offset = (2 * (dsk_offset_t)geom->dg_cylinders - 1 - cylinder);
 			}
 			else
 			{
@@ -241,22 +286,53 @@ unsigned long posix_offset(POSIX_DSK_DRIVER *pxself, const DSK_GEOMETRY *geom,
 			}
 			break;
 		case SIDES_OUTOUT:
-			offset = (head * geom->dg_cylinders) + cylinder;
+			offset = ((dsk_offset_t)head * geom->dg_cylinders) + cylinder;
 			break;
 				
 	}
 	offset *= geom->dg_sectors;
 	offset += (sector - geom->dg_secbase);
 	offset *=  geom->dg_secsize;
-	return offset;
+	return offset + pxself->px_base;
+}
+
+#if defined(HAVE_UNISTD_H) && !defined(_WIN32)
+/* Reads with pread(), bypassing stdio. The file position is not used, so
+ * several threads can read through the same driver at once, as long as
+ * nothing is written meanwhile. Anything still sitting in stdio's buffers
+ * has to reach the file first. */
+static dsk_err_t posix_pread(POSIX_DSK_DRIVER *self, void *buf, size_t len,
+			dsk_offset_t offset)
+{
+	size_t done = 0;
+
+	if (self->px_unflushed)
+	{
+		if (fflush(self->px_fp)) return DSK_ERR_SYSERR;
+		self->px_unflushed = 0;
+	}
+	if (offset != (dsk_offset_t)(off_t)offset || (off_t)offset < 0)
+		return DSK_ERR_SYSERR;
+
+	while (done < len)
+	{
+		ssize_t n = pread(fileno(self->px_fp), (char *)buf + done, 
+				len - done, (off_t)(offset + done));
+		if (n < 0) return DSK_ERR_SYSERR;
+		if (n == 0) break;
+		done += n;
+	}
+	if (done < len) return DSK_ERR_NOADDR;
+	return DSK_ERR_OK;
 }
+#endif
 
 dsk_err_t posix_read(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                              void *buf, dsk_pcyl_t cylinder,
                               dsk_phead_t head, dsk_psect_t sector)
 {
 	POSIX_DSK_DRIVER *pxself;
-	unsigned long offset;
+	dsk_offset_t offset;
 
 	if (!buf || !self || !geom) return DSK_ERR_BADPTR;
 	CHECK_CLASS(self);
@@ -265,31 +341,38 @@ dsk_err_t posix_read(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 
 	offset = posix_offset(pxself, geom, cylinder, head, sector);
 
-	if (fseek(pxself->px_fp, offset, SEEK_SET)) return DSK_ERR_SYSERR;
+#if defined(HAVE_UNISTD_H) && !defined(_WIN32)
+	return posix_pread(pxself, buf, geom->dg_secsize, offset);
+#else
+	if (posix_seek(pxself->px_fp, offset)) return DSK_ERR_SYSERR;
 
 	if (fread(buf, 1, geom->dg_secsize, pxself->px_fp) < geom->dg_secsize)
 	{
 		return DSK_ERR_NOADDR;
 	}
 	return DSK_ERR_OK;
+#endif
 }
 
 
-static dsk_err_t seekto(POSIX_DSK_DRIVER *self, unsigned long offset)
+static dsk_err_t seekto(POSIX_DSK_DRIVER *self, dsk_offset_t offset)
 {
+	/* Whatever follows is buffered by stdio */
+	self->px_unflushed = 1;
+
 	/* 0.9.5: Fill any "holes" in the file with 0xE5. Otherwise, UNIX would
 	 * fill them with zeroes and Windows would fill them with whatever
 	 * happened to be lying around */
 	if (self->px_filesize < offset)
 	{
-		if (fseek(self->px_fp, self->px_filesize, SEEK_SET)) return DSK_ERR_SYSERR;
+		if (posix_seek(self->px_fp, self->px_filesize)) return DSK_ERR_SYSERR;
 		while (self->px_filesize < offset)
 		{
 			if (fputc(0xE5, self->px_fp) == EOF) return DSK_ERR_SYSERR;
 			++self->px_filesize;
 		}
 	}
-	if (fseek(self->px_fp, offset, SEEK_SET)) return DSK_ERR_SYSERR;
+	if (posix_seek(self->px_fp, offset)) return DSK_ERR_SYSERR;
 	return DSK_ERR_OK;
 }
 
@@ -298,7 +381,7 @@ dsk_err_t posix_write(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                               dsk_phead_t head, dsk_psect_t sector)
 {
 	POSIX_DSK_DRIVER *pxself;
-	unsigned long offset;
+	dsk_offset_t offset;
 	dsk_err_t err;
 
 	if (!buf || !self || !geom)
@@ -324,6 +407,97 @@ dsk_err_t posix_write(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 }
 
 
+/* Consecutive logical sectors are consecutive in the file if the image
+ * and the geometry agree on the track order */
+static int posix_linear(POSIX_DSK_DRIVER *self, const DSK_GEOMETRY *geom)
+{
+	if (geom->dg_sidedness == SIDES_EXTSURFACE ||
+	    self->px_sides == SIDES_EXTSURFACE) return 0;
+
+	return (geom->dg_heads == 1 || geom->dg_sidedness == self->px_sides);
+}
+
+/* Find where a run of logical sectors starts in the file, checking that
+ * the whole run is on the disc */
+static dsk_err_t posix_runoffset(POSIX_DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+				dsk_lsect_t sector, unsigned count,
+				dsk_offset_t *offset)
+{
+	dsk_pcyl_t cylinder;
+	dsk_phead_t head;
+	dsk_psect_t psect;
+	dsk_err_t err;
+
+	if (!count) return DSK_ERR_BADPARM;
+	if (!posix_linear(self, geom)) return DSK_ERR_NOTIMPL;
+
+	err = dg_ls2ps(geom, sector + count - 1, &cylinder, &head, &psect);
+	if (err) return err;
+	err = dg_ls2ps(geom, sector, &cylinder, &head, &psect);
+	if (err) return err;
+
+	*offset = posix_offset(self, geom, cylinder, head, psect);
+	return DSK_ERR_OK;
+}
+
+dsk_err_t posix_lread_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+			void *buf, dsk_lsect_t sector, unsigned count)
+{
+	POSIX_DSK_DRIVER *pxself;
+	dsk_offset_t offset;
+	size_t len;
+	dsk_err_t err;
+
+	if (!buf || !self || !geom) return DSK_ERR_BADPTR;
+	CHECK_CLASS(self);
+
+	if (!pxself->px_fp) return DSK_ERR_NOTRDY;
+
+	err = posix_runoffset(pxself, geom, sector, count, &offset);
+	if (err) return err;
+	len = (size_t)count * geom->dg_secsize;
+
+#if defined(HAVE_UNISTD_H) && !defined(_WIN32)
+	/* Read the whole run at once */
+	return posix_pread(pxself, buf, len, offset);
+#else
+	if (posix_seek(pxself->px_fp, offset)) return DSK_ERR_SYSERR;
+	if (fread(buf, 1, len, pxself->px_fp) < len) return DSK_ERR_NOADDR;
+	return DSK_ERR_OK;
+#endif
+}
+
+dsk_err_t posix_lwrite_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+			const void *buf, dsk_lsect_t sector, unsigned count)
+{
+	POSIX_DSK_DRIVER *pxself;
+	dsk_offset_t offset;
+	size_t len;
+	dsk_err_t err;
+
+	if (!buf || !self || !geom) return DSK_ERR_BADPTR;
+	CHECK_CLASS(self);
+
+	if (!pxself->px_fp) return DSK_ERR_NOTRDY;
+	if (pxself->px_readonly) return DSK_ERR_RDONLY;
+
+	err = posix_runoffset(pxself, geom, sector, count, &offset);
+	if (err) return err;
+	len = (size_t)count * geom->dg_secsize;
+
+	err = seekto(pxself, offset);
+	if (err) return err;
+
+	if (fwrite(buf, 1, len, pxself->px_fp) < len)
+	{
+		return DSK_ERR_NOADDR;
+	}
+	if (pxself->px_filesize < offset + len)
+		pxself->px_filesize = offset + len;
+	return DSK_ERR_OK;
+}
+
+
 dsk_err_t posix_format(DSK_DRIVER *self, DSK_GEOMETRY *geom,
                                 dsk_pcyl_t cylinder, dsk_phead_t head,
                                 const DSK_FORMAT *format, unsigned char filler)
@@ -333,7 +507,7 @@ dsk_err_t posix_format(DSK_DRIVER *self, DSK_GEOMETRY *geom,
  * images don't hold track headers.
  */
 	POSIX_DSK_DRIVER *pxself;
-	unsigned long offset;
+	dsk_offset_t offset;
 	unsigned long trklen;
 	dsk_err_t err;
 
@@ -369,7 +543,7 @@ dsk_err_t posix_xseek(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                       dsk_pcyl_t cylinder, dsk_phead_t head)
 {
 	POSIX_DSK_DRIVER *pxself;
-	long offset;
+	dsk_offset_t offset;
 
 	if (!self || !geom) return DSK_ERR_BADPTR;
 	CHECK_CLASS(self);
@@ -383,11 +557,23 @@ dsk_err_t posix_xseek(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 	 * functions, this _always_ uses "SIDES_ALT" mapping; this is the 
 	 * mapping that both the Linux and NT floppy drivers use to convert 
 	 * offsets back into C/H/S. */
-	offset = (cylinder * geom->dg_heads) + head;	/* Drive track */
+	offset = ((dsk_offset_t)cylinder * geom->dg_heads) + head;	/* Drive track */
 	offset *= geom->dg_sectors * geom->dg_secsize;
+	offset += pxself->px_base;
 	
-	if (fseek(pxself->px_fp, offset, SEEK_SET)) return DSK_ERR_SEEKFAIL;
+	if (posix_seek(pxself->px_fp, offset)) return DSK_ERR_SEEKFAIL;
+
+	return DSK_ERR_OK;
+}
+
+dsk_err_t posix_set_offset(DSK_DRIVER *self, dsk_offset_t offset)
+{
+	POSIX_DSK_DRIVER *pxself;
+
+	if (!self) return DSK_ERR_BADPTR;
+	CHECK_CLASS(self);
 
+	pxself->px_base = offset;
 	return DSK_ERR_OK;
 }
 
@@ -533,7 +719,7 @@ static dsk_err_t posix_from_ldbs_callback(PLDBS ldbs, dsk_pcyl_t cyl,
 	int n;
 	size_t len;
 	unsigned char *secbuf;
-	long offset;
+	dsk_offset_t offset;
 
 	if (pxself->px_readonly) return DSK_ERR_RDONLY;
 
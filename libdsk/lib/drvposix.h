@@ -27,8 +27,10 @@ typedef struct
         DSK_DRIVER px_super;
         FILE *px_fp;
 	int   px_readonly;
-	unsigned long  px_filesize;
+	dsk_offset_t  px_filesize;
 	dsk_sides_t px_sides;
+	int   px_unflushed;	/* Writes may still be in stdio buffers */
+	dsk_offset_t px_base;	/* Where the image starts in the file */
 	DSK_GEOMETRY *px_export_geom;
 } POSIX_DSK_DRIVER;
 
@@ -45,11 +47,16 @@ dsk_err_t posix_read(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 dsk_err_t posix_write(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                               const void *buf, dsk_pcyl_t cylinder,
                               dsk_phead_t head, dsk_psect_t sector);
+dsk_err_t posix_lread_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+                              void *buf, dsk_lsect_t sector, unsigned count);
+dsk_err_t posix_lwrite_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+                              const void *buf, dsk_lsect_t sector, unsigned count);
 dsk_err_t posix_format(DSK_DRIVER *self, DSK_GEOMETRY *geom,
                                 dsk_pcyl_t cylinder, dsk_phead_t head,
                                 const DSK_FORMAT *format, unsigned char filler);
 dsk_err_t posix_xseek(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                                 dsk_pcyl_t cylinder, dsk_phead_t head);
+dsk_err_t posix_set_offset(DSK_DRIVER *self, dsk_offset_t offset);
 dsk_err_t posix_status(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                                 dsk_phead_t head, unsigned char *result);
 dsk_err_t posix_to_ldbs(DSK_DRIVER *self, struct ldbs **result, DSK_GEOMETRY *geom);
@@ -75,7 +75,9 @@ DRV_CLASS dc_simh =
 	NULL,		/* trackids */
 	NULL,		/* rtread */
 	simh_to_ldbs,	/* export as LDBS */
-	simh_from_ldbs	/* import as LDBS */
+	simh_from_ldbs,	/* import as LDBS */
+	simh_lread_multi,	/* read a run of logical sectors */
+	NULL		/* write a run of logical sectors */
 };
 
 
@@ -185,6 +187,50 @@ dsk_err_t simh_read(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 	return DSK_ERR_OK;
 }
 
+/* With the fixed geometry, logical sector n is the n-th 137-byte record.
+ * Read the records of a run in one go, then drop headers and trailers. */
+dsk_err_t simh_lread_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+			void *buf, dsk_lsect_t sector, unsigned count)
+{
+	SIMH_DSK_DRIVER *simh_self;
+	unsigned char *records;
+	unsigned long len, aread, n;
+
+	if (!buf || !self || !geom || self->dr_class != &dc_simh) return DSK_ERR_BADPTR;
+	simh_self = (SIMH_DSK_DRIVER *)self;
+
+	if (!simh_self->simh_fp) return DSK_ERR_NOTRDY;
+	if (!count) return DSK_ERR_BADPARM;
+
+	/* Anything else than the fixed geometry goes sector by sector */
+	if (geom->dg_sidedness != SIDES_ALT || geom->dg_heads != 2 ||
+	    geom->dg_sectors != 32 || geom->dg_secbase != 0 || 
+	    geom->dg_secsize != 128) return DSK_ERR_NOTIMPL;
+	if (sector + count > 127L * 2 * 32) return DSK_ERR_BADPARM;
+
+	len = 137L * count;
+	records = dsk_malloc(len);
+	if (!records) return DSK_ERR_NOMEM;
+
+	if (fseek(simh_self->simh_fp, 137L * sector, SEEK_SET))
+	{
+		dsk_free(records);
+		return DSK_ERR_SYSERR;
+	}
+	/* Fill missing data with 0xE5 */
+	aread = fread(records, 1, len, simh_self->simh_fp);
+	while (aread < len)
+	{
+		records[aread++] = 0xE5;	
+	}
+	for (n = 0; n < count; n++)
+	{
+		memcpy((unsigned char *)buf + 128 * n, records + 137 * n + 3, 128);
+	}
+	dsk_free(records);
+	return DSK_ERR_OK;
+}
+
 static unsigned char trailer[4] = { 0xE5, 0xE5, 0xE5, 0xE5 };
 
 dsk_err_t simh_write(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
@@ -39,6 +39,8 @@ dsk_err_t simh_read(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
 dsk_err_t simh_write(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
                               const void *buf, dsk_pcyl_t cylinder,
                               dsk_phead_t head, dsk_psect_t sector);
+dsk_err_t simh_lread_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+                              void *buf, dsk_lsect_t sector, unsigned count);
 dsk_err_t simh_format(DSK_DRIVER *self, DSK_GEOMETRY *geom,
                                 dsk_pcyl_t cylinder, dsk_phead_t head,
                                 const DSK_FORMAT *format, unsigned char filler);
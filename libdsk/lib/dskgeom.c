@@ -560,6 +560,16 @@ LDPUBLIC32 dsk_err_t LDPUBLIC16 dg_dosgeom(DSK_GEOMETRY *self, const unsigned ch
 	self->dg_sectors   = bootsect[24] + 256 * bootsect[25];
 	if (!self->dg_heads || !self->dg_sectors) return DSK_ERR_BADFMT;
 	lsmax = bootsect[19] + 256 * bootsect[20];
+	/* FAT32 and large FAT16 volumes have the 32-bit count at 0x20 instead;
+	 * it is rounded up, so that a partial last cylinder can still be 
+	 * accessed. The geometry of the images having a 16-bit count is
+	 * unchanged */
+	if (!lsmax)
+	{
+		lsmax = bootsect[32] + 256 * bootsect[33] + 
+			((dsk_lsect_t)bootsect[34] << 16) + ((dsk_lsect_t)bootsect[35] << 24);
+		lsmax += (dsk_lsect_t)self->dg_heads * self->dg_sectors - 1;
+	}
 	lsmax /= self->dg_heads;
 	lsmax /= self->dg_sectors;
 	self->dg_cylinders = (dsk_pcyl_t)lsmax; 
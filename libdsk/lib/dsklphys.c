@@ -39,7 +39,7 @@ LDPUBLIC32 dsk_err_t LDPUBLIC16 dg_ps2ls(const DSK_GEOMETRY *self,
 	if (sec  < self->dg_secbase || 
 	    sec  >= self->dg_secbase + self->dg_sectors) return DSK_ERR_BADPTR;
 
-	sector = track * self->dg_sectors;
+	sector = (dsk_lsect_t)track * self->dg_sectors;
 	sector += (sec - self->dg_secbase);
 
 	if (logical) *logical = sector;
@@ -57,7 +57,8 @@ LDPUBLIC32 dsk_err_t LDPUBLIC16  dg_ls2ps(const DSK_GEOMETRY *self,
 	if (!self) return DSK_ERR_BADPTR;
 	if (!self->dg_sectors || !self->dg_heads) return DSK_ERR_DIVZERO;
 
-	if (logical >= self->dg_cylinders * self->dg_heads * self->dg_sectors)
+	/* Widen before multiplying, large hard drive geometries overflow an int */
+	if (logical >= (dsk_lsect_t)self->dg_cylinders * self->dg_heads * self->dg_sectors)
 		return DSK_ERR_BADPARM;
 
 	if (sec)
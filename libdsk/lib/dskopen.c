@@ -303,6 +303,20 @@ LDPUBLIC32 const char * LDPUBLIC16 dsk_drvdesc(DSK_DRIVER *self)
 
 
 
+LDPUBLIC32 dsk_err_t LDPUBLIC16 dsk_set_offset(DSK_DRIVER *self, dsk_offset_t offset)
+{
+	DRV_CLASS *dc;
+
+	if (!self || !self->dr_class) return DSK_ERR_BADPTR;
+
+	dc = self->dr_class;
+
+	WALK_VTABLE(dc, dc_set_offset)
+	if (!dc->dc_set_offset) return DSK_ERR_NOTIMPL;
+	return (dc->dc_set_offset)(self, offset);
+}
+
+
 LDPUBLIC32 const char * LDPUBLIC16 dsk_compname(DSK_DRIVER *self)
 {
         if (!self) return "(null)";
@@ -72,6 +72,48 @@ LDPUBLIC32 dsk_err_t LDPUBLIC16 dsk_lread(DSK_DRIVER *self, const DSK_GEOMETRY *
 }
 
 
+LDPUBLIC32 dsk_err_t LDPUBLIC16 dsk_lread_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+                              void *buf, dsk_lsect_t sector, unsigned count)
+{
+	DRV_CLASS *dc;
+	dsk_err_t e = DSK_ERR_NOTIMPL;
+	unsigned n;
+	unsigned long m;
+
+	if (!self || !geom || !buf || !self->dr_class) return DSK_ERR_BADPTR;
+
+	dc = self->dr_class;
+
+	WALK_VTABLE(dc, dc_lread_multi)
+	if (dc->dc_lread_multi)
+	{
+		for (n = 0; n < self->dr_retry_count; n++)
+		{
+			e = (dc->dc_lread_multi)(self,geom,buf,sector,count);
+			if (!DSK_TRANSIENT_ERROR(e)) break;
+		}
+		/* If flagged to complement bytes, complement them */
+		if (e == DSK_ERR_OK && (geom->dg_fm & RECMODE_COMPLEMENT))
+		{
+			for (m = 0; m < (unsigned long)count * geom->dg_secsize; m++)
+			{
+				((char *)buf)[m] = ~((char *)buf)[m];
+			}
+		}
+		if (e != DSK_ERR_NOTIMPL) return e;
+	}
+	/* Driver can't do it in one go: read sector by sector */
+	for (n = 0; n < count; n++)
+	{
+		e = dsk_lread(self, geom, 
+			((char *)buf) + (unsigned long)n * geom->dg_secsize, 
+			sector + n);
+		if (e != DSK_ERR_OK) return e;
+	}
+	return DSK_ERR_OK;
+}
+
+
 LDPUBLIC32 dsk_err_t LDPUBLIC16 dsk_xread(DSK_DRIVER *self, const DSK_GEOMETRY *geom, void *buf, 
 			dsk_pcyl_t cylinder,   dsk_phead_t head, 
 			dsk_pcyl_t cyl_expect, dsk_phead_t head_expect, 
@@ -87,6 +87,58 @@ LDPUBLIC32 dsk_err_t LDPUBLIC16 dsk_lwrite(DSK_DRIVER *self, const DSK_GEOMETRY
 }
 
 
+LDPUBLIC32 dsk_err_t LDPUBLIC16 dsk_lwrite_multi(DSK_DRIVER *self, const DSK_GEOMETRY *geom,
+                              const void *buf, dsk_lsect_t sector, unsigned count)
+{
+	DRV_CLASS *dc;
+	dsk_err_t e = DSK_ERR_NOTIMPL;
+	unsigned n;
+	unsigned long m, len;
+	unsigned char *inv_buf = NULL;
+	const void *run = buf;
+
+	if (!self || !geom || !buf || !self->dr_class) return DSK_ERR_BADPTR;
+
+	dc = self->dr_class;
+
+	if (self && self->dr_compress && self->dr_compress->cd_readonly)
+		return DSK_ERR_RDONLY;
+
+	WALK_VTABLE(dc, dc_lwrite_multi)
+	if (dc->dc_lwrite_multi)
+	{
+		len = (unsigned long)count * geom->dg_secsize;
+		/* If we are storing the complement, generate complemented run */
+		if (geom->dg_fm & RECMODE_COMPLEMENT)
+		{
+			inv_buf = dsk_malloc(len);
+
+			if (!inv_buf) return DSK_ERR_NOMEM;
+			for (m = 0; m < len; m++) 
+				inv_buf[m] = ~((char *)buf)[m];
+			run = inv_buf;
+		}
+		for (n = 0; n < self->dr_retry_count; n++)
+		{
+			e = (dc->dc_lwrite_multi)(self,geom,run,sector,count);
+			if (e == DSK_ERR_OK) self->dr_dirty = 1;
+			if (!DSK_TRANSIENT_ERROR(e)) break;
+		}
+		if (inv_buf != NULL) dsk_free(inv_buf);
+		if (e != DSK_ERR_NOTIMPL) return e;
+	}
+	/* Driver can't do it in one go: write sector by sector */
+	for (n = 0; n < count; n++)
+	{
+		e = dsk_lwrite(self, geom, 
+			((const char *)buf) + (unsigned long)n * geom->dg_secsize, 
+			sector + n);
+		if (e != DSK_ERR_OK) return e;
+	}
+	return DSK_ERR_OK;
+}
+
+
 LDPUBLIC32 dsk_err_t LDPUBLIC16 dsk_xwrite(DSK_DRIVER *self, const DSK_GEOMETRY *geom, 
             const void *buf, 
                         dsk_pcyl_t cylinder,   dsk_phead_t head,
@@ -1,7 +1,9 @@
 #include "FatChain.h"
 
 FatChain::FatChain()
-    : orphaned(true),
+    : startCluster(0),
+    endCluster(0),
+    orphaned(true),
     directory(false),
     elements(1),
     length(1),
@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <map>
 #include <list>
 #include <stdio.h>
 #include <set>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 
@@ -16,6 +18,11 @@ bool compare_size(FatChain &A, FatChain &B)
 {
     return A.size > B.size;
 }
+
+bool compare_start(const FatChain &A, const FatChain &B)
+{
+    return A.startCluster < B.startCluster;
+}
         
 FatChains::FatChains(FatSystem &system)
     : FatModule(system),
@@ -29,12 +36,12 @@ void FatChains::chainsAnalysis()
     system.enableCache();
 
     cout << "Building the chains..." << endl;
-    map<int, FatChain> chains = findChains();
+    vector<FatChain> chains = findChains();
 
     /*
-    map<int, FatChain>::iterator mit;
+    vector<FatChain>::iterator mit;
     for (mit=chains.begin(); mit!=chains.end(); mit++) {
-        cout << mit->first << "~>" << mit->second.endCluster << endl;
+        cout << mit->startCluster << "~>" << mit->endCluster << endl;
     } 
     */
 
@@ -58,35 +65,101 @@ void FatChains::chainsAnalysis()
     displayOrphaned(orphanedChains);
 }
 
-void FatChains::exploreChains(map<int, FatChain> &chains, set<int> &visited)
+void FatChains::exploreChains(vector<FatChain> &chains, set<int> &visited)
 {
-    map<int, FatChain>::iterator it;
-    bool foundNew;
+    vector<FatChain>::iterator it;
+    bool foundNew = false;
     exploreDamaged = true;
-    do {
-        foundNew = false;
-        for (it=chains.begin(); it!=chains.end(); it++) {
-            FatChain &chain = it->second;
-
-            if (chain.orphaned) {
-                // cout << "Trying " << chain.startCluster << endl;
-                vector<FatEntry> entries = system.getEntries(chain.startCluster);
+
+    pending.clear();
+    for (it=chains.begin(); it!=chains.end(); it++) {
+        if (it->orphaned) {
+            pending.insert(it->startCluster);
+        }
+    }
+
+    // The chains are examined by increasing start cluster, a chain created
+    // before the current one will be examined in the next pass, if the
+    // previous one found something new
+    set<int>::iterator next = pending.begin();
+    while (true) {
+        if (next == pending.end()) {
+            if (!foundNew || pending.empty()) {
+                break;
+            }
+            foundNew = false;
+            next = pending.begin();
+        }
+
+        int start = *next;
+        pending.erase(next);
+        // The exploration can create chains, the chain is known by position
+        int index = findChain(chains, start);
+
+        if (index >= 0 && chains[index].orphaned) {
+            // cout << "Trying " << start << endl;
+            map<int, bool>::iterator known = directories.find(start);
+
+            if (known != directories.end()) {
+                // Already explored
+                if (known->second) {
+                    chains[index].directory = true;
+                }
+            } else {
+                vector<FatEntry> entries = system.getEntries(start);
                 if (entries.size()) {
-                    chain.directory = true;
-                    if (recursiveExploration(chains, visited, chain.startCluster, &entries)) {
+                    chains[index].directory = true;
+                    if (recursiveExploration(chains, visited, start, &entries)) {
                         foundNew = true;
                     }
-                    chain.orphaned = true;
+                    chains[index].orphaned = true;
+                } else {
+                    directories[start] = false;
                 }
             }
         }
-    } while (foundNew);
+
+        next = pending.upper_bound(start);
+    }
 }
-    
-/**
- * Explore a directory
- */
-bool FatChains::recursiveExploration(map<int, FatChain> &chains, set<int> &visited, int cluster, vector<FatEntry> *inputEntries)
+
+int FatChains::findChain(vector<FatChain> &chains, int cluster)
+{
+    // The chains found in the FAT are sorted, the created ones follow
+    vector<FatChain>::iterator sortedEnd = chains.end()-created.size();
+    FatChain key;
+    key.startCluster = cluster;
+
+    vector<FatChain>::iterator it = lower_bound(chains.begin(), sortedEnd, key, compare_start);
+    if (it != sortedEnd && it->startCluster == cluster) {
+        return it-chains.begin();
+    }
+
+    unordered_map<int, int>::iterator other = created.find(cluster);
+    if (other != created.end()) {
+        return other->second;
+    }
+
+    return -1;
+}
+
+FatChain &FatChains::getChain(vector<FatChain> &chains, int cluster)
+{
+    int index = findChain(chains, cluster);
+
+    if (index < 0) {
+        index = chains.size();
+        chains.push_back(FatChain());
+        chains.back().startCluster = cluster;
+        created[cluster] = index;
+        pending.insert(cluster);
+    }
+
+    return chains[index];
+}
+
+bool FatChains::enterDirectory(set<int> &visited, int cluster, vector<FatEntry> *inputEntries,
+        vector<Exploration> &stack)
 {
     if (visited.find(cluster) != visited.end()) {
         return false;
@@ -95,24 +168,64 @@ bool FatChains::recursiveExploration(map<int, FatChain> &chains, set<int> &visit
     if (!exploreDamaged && system.nextCluster(cluster) == 0) {
         return false;
     }
-    
+
     visited.insert(cluster);
-    
-    bool foundNew = false;
-    int myCluster = cluster;
 
     cout << "Exploring " << cluster << endl;
 
-    vector<FatEntry> entries;
+    stack.push_back(Exploration());
+    Exploration &directory = stack.back();
+    directory.cluster = cluster;
+    directory.index = 0;
+    directory.returning = false;
+    directory.child = 0;
+    directory.wasOrphaned = false;
+
     if (inputEntries != NULL) {
-        entries = *inputEntries;
+        directory.entries = *inputEntries;
     } else {
-        entries = system.getEntries(cluster);
+        directory.entries = system.getEntries(cluster);
+    }
+    directories[cluster] = directory.entries.size() > 0;
+
+    return true;
+}
+
+/**
+ * Explore a directory
+ */
+bool FatChains::recursiveExploration(vector<FatChain> &chains, set<int> &visited, int cluster, vector<FatEntry> *inputEntries)
+{
+    vector<Exploration> stack;
+    bool foundNew = false;
+
+    if (!enterDirectory(visited, cluster, inputEntries, stack)) {
+        return false;
     }
-    vector<FatEntry>::iterator it;
 
-    for (it=entries.begin(); it!=entries.end(); it++) {
-        FatEntry &entry = (*it);
+    while (!stack.empty()) {
+        Exploration &directory = stack.back();
+        int myCluster = directory.cluster;
+
+        if (directory.returning) {
+            // The entry and its sub-directory were explored
+            directory.returning = false;
+            if (directory.wasOrphaned) {
+                // Getting the parent can create it and move the child
+                FatChain child = getChain(chains, directory.child);
+                FatChain &parent = getChain(chains, myCluster);
+                parent.elements += child.elements;
+                parent.size += child.size;
+            }
+            continue;
+        }
+
+        if (directory.index >= directory.entries.size()) {
+            stack.pop_back();
+            continue;
+        }
+
+        FatEntry &entry = directory.entries[directory.index++];
         int cluster = entry.cluster;
         bool wasOrphaned = false;
 
@@ -120,11 +233,15 @@ bool FatChains::recursiveExploration(map<int, FatChain> &chains, set<int> &visit
             continue;
         }
 
+        string name = entry.getFilename();
+
         // Search the cluster in the previously visited chains, if it
         // exists, mark it as non-orphaned
-        if (chains.find(cluster)!=chains.end()) {
-            if (entry.getFilename() != ".." && entry.getFilename() != ".") {
-                if (chains[cluster].orphaned) {
+        int index = findChain(chains, cluster);
+        if (index >= 0) {
+            if (name != ".." && name != ".") {
+                FatChain &chain = chains[index];
+                if (chain.orphaned) {
                     wasOrphaned = true;
 
                     if (saveEntries) {
@@ -133,113 +250,193 @@ bool FatChains::recursiveExploration(map<int, FatChain> &chains, set<int> &visit
                     }
                 }
                 // cout << "Unorphaning " << cluster << " from " << myCluster << endl;
-                chains[cluster].orphaned = false;
+                chain.orphaned = false;
 
                 if (!entry.isDirectory()) {
-                    chains[cluster].size = entry.size;
+                    chain.size = entry.size;
                 }
             }
         } else {
             // Creating the entry
-            if (exploreDamaged && entry.getFilename() != ".") {
-                chains[cluster].startCluster = cluster;
-                chains[cluster].endCluster = cluster;
-                chains[cluster].directory = entry.isDirectory();
-                chains[cluster].elements = 1;
-                chains[cluster].orphaned = (entry.getFilename() == "..");
+            if (exploreDamaged && name != ".") {
+                FatChain &chain = getChain(chains, cluster);
+                chain.startCluster = cluster;
+                chain.endCluster = cluster;
+                chain.directory = entry.isDirectory();
+                chain.elements = 1;
+                chain.orphaned = (name == "..");
 
                 // cout << "Discovering new entry " << entry.getFilename() << endl;
 
-                if (!chains[cluster].orphaned) {
+                if (!chain.orphaned) {
                     wasOrphaned = true;
                     if (saveEntries) {
                         orphanEntries[myCluster].push_back(entry);
                         clusterToEntry[cluster] = entry;
                     }
                 }
-                    
-                foundNew = true;
+
+                // Only the entries of the explored directory itself count
+                if (stack.size() == 1) {
+                    foundNew = true;
+                }
             }
         }
 
-        if (entry.isDirectory() && entry.getFilename() != "..") {
-            recursiveExploration(chains, visited, cluster);
-        }
-        
-        if (wasOrphaned) {
-            chains[myCluster].elements += chains[cluster].elements;
-            chains[myCluster].size += chains[cluster].size;
+        directory.returning = true;
+        directory.child = cluster;
+        directory.wasOrphaned = wasOrphaned;
+
+        if (entry.isDirectory() && name != "..") {
+            // This can grow the stack and move the directory
+            enterDirectory(visited, cluster, NULL, stack);
         }
     }
 
     return foundNew;
 }
 
+/**
+ * A cluster where a chain can be joined by another one
+ */
+struct ChainJoin
+{
+    int chain;
+    int position;
+    unsigned int previous;
+};
+
 /**
  * Find all cluster chains in the FAT
+ *
+ * The predecessors of the clusters are counted first: the chains start at
+ * the allocated clusters having none, then at the clusters of the loops
+ * that are not reached from any of them. Each cluster is walked once, only
+ * the clusters having several predecessors are remembered to know where a
+ * chain goes when it joins another one.
  */
-map<int, FatChain> FatChains::findChains()
+vector<FatChain> FatChains::findChains()
 {
-    set<int> seen;
-    map<int, FatChain> chains;
-
-    for (int cluster=system.rootDirectory; cluster<system.totalClusters; cluster++) {
-        // This cluster is new
-        if (seen.find(cluster) == seen.end()) {
-            // If this is an allocated cluster
-            if (!system.freeCluster(cluster)) {
-                set<int> localSeen;
-                int next = cluster;
-                int length = 1;
-                // Walking through the chain
-                while (true) {
-                    int tmp = system.nextCluster(next);
-                    if (tmp == FAT_LAST || !system.validCluster(tmp)) {
-                        break;
-                    }
-                    if (localSeen.find(tmp) != localSeen.end()) {
-                        fprintf(stderr, "! Loop\n");
-                        break;
+    unsigned int total = system.totalClusters;
+    const vector<uint32_t> &table = system.getTable().entries;
+    vector<bool> hasPredecessor(total), manyPredecessors(total), visited(total);
+
+    // Clusters 0 and 1 are reserved, the root directory of FAT12/16 is
+    // not a chain
+    unsigned int first = system.rootDirectory < 2 ? 2 : system.rootDirectory;
+
+    for (unsigned int cluster=2; cluster<total; cluster++) {
+        unsigned int next = table[cluster];
+        if (next >= 2 && next != (uint32_t)FAT_LAST && next < total) {
+            if (hasPredecessor[next]) {
+                manyPredecessors[next] = true;
+            }
+            hasPredecessor[next] = true;
+        }
+    }
+
+    vector<FatChain> chains;
+    created.clear();
+    // For each chain, the loop flag and the position where its own loop starts
+    vector<bool> looping;
+    vector<int> loopStart;
+    unordered_map<unsigned int, ChainJoin> joins;
+    unsigned int heads = 0;
+
+    for (int pass=0; pass<2; pass++) {
+        for (unsigned int cluster=first; cluster<total; cluster++) {
+            if (visited[cluster] || table[cluster] == 0) {
+                continue;
+            }
+            if (pass == 0 && hasPredecessor[cluster]) {
+                continue;
+            }
+
+            int index = chains.size();
+            FatChain chain;
+            chain.startCluster = cluster;
+            bool loop = false;
+            int ownLoop = -1;
+            unsigned int next = cluster;
+            int length = 1;
+
+            visited[cluster] = true;
+            if (hasPredecessor[cluster]) {
+                ChainJoin join = {index, 0, cluster};
+                joins[cluster] = join;
+            }
+
+            // Walking through the chain, a cluster already walked has
+            // several predecessors, or starts a loop
+            while (true) {
+                unsigned int tmp = table[next];
+                if (tmp < 2 || tmp == (uint32_t)FAT_LAST || tmp >= total) {
+                    break;
+                }
+                if (visited[tmp]) {
+                    ChainJoin &join = joins[tmp];
+                    loop = true;
+
+                    if (join.chain == index) {
+                        ownLoop = join.position;
+                    } else {
+                        // Joining a previous chain, which continues the same way
+                        FatChain &other = chains[join.chain];
+                        loop = looping[join.chain];
+
+                        if (loopStart[join.chain] >= 0 && join.position > loopStart[join.chain]) {
+                            next = join.previous;
+                            length += other.length-loopStart[join.chain];
+                        } else {
+                            next = other.endCluster;
+                            length += other.length-join.position;
+                        }
                     }
-                    next = tmp;
-                    length++;
-                    seen.insert(next);
-                    localSeen.insert(next);
+                    break;
+                }
+                visited[tmp] = true;
+                if (manyPredecessors[tmp]) {
+                    ChainJoin join = {index, length, next};
+                    joins[tmp] = join;
                 }
+                next = tmp;
+                length++;
+            }
 
-                FatChain chain;
-                chain.startCluster = cluster;
-                chain.endCluster = next;
-                chain.length = length;
+            if (loop) {
+                fprintf(stderr, "! Loop\n");
+            }
 
-                if (chain.startCluster == system.rootDirectory) {
-                    chain.orphaned = false;
-                }
-                    
-                chains[next] = chain;
+            chain.endCluster = next;
+            chain.length = length;
+
+            if (cluster == system.rootDirectory) {
+                chain.orphaned = false;
             }
 
-            seen.insert(cluster);
+            chains.push_back(chain);
+            looping.push_back(loop);
+            loopStart.push_back(ownLoop);
         }
-    }
 
-    map<int, FatChain> chainsByStart;
-    map<int, FatChain>::iterator it;
-    for (it=chains.begin(); it!=chains.end(); it++) {
-        FatChain &chain = it->second;
-        chainsByStart[chain.startCluster] = chain;
+        if (pass == 0) {
+            heads = chains.size();
+        }
     }
 
-    return chainsByStart;
+    // The chains starting loops come last, both parts are sorted
+    inplace_merge(chains.begin(), chains.begin()+heads, chains.end(), compare_start);
+
+    return chains;
 }
     
-list<FatChain> FatChains::getOrphaned(map<int, FatChain> &chains)
+list<FatChain> FatChains::getOrphaned(vector<FatChain> &chains)
 {
     list<FatChain> orphanedChains;
-    map<int, FatChain>::iterator it;
+    vector<FatChain>::iterator it;
 
     for (it=chains.begin(); it!=chains.end(); it++) {
-        FatChain &chain = it->second;
+        FatChain &chain = *it;
 
         if (chain.startCluster < 2) {
             chain.orphaned = false;
@@ -253,6 +450,9 @@ list<FatChain> FatChains::getOrphaned(map<int, FatChain> &chains)
         }
     }
 
+    // The chains created while exploring follow the ones of the FAT
+    orphanedChains.sort(compare_start);
+
     return orphanedChains;
 }
 
@@ -308,31 +508,5 @@ void FatChains::displayOrphaned(list<FatChain> orphanedChains)
 
 int FatChains::chainSize(int cluster, bool *isContiguous)
 {
-    set<int> visited;
-    int length = 0;
-    bool stop;
-
-    if (isContiguous != NULL) {
-        *isContiguous = true;
-    }
-
-    do {
-        stop = true;
-        int currentCluster = cluster;
-        visited.insert(cluster);
-        length++;
-        cluster = system.nextCluster(cluster);
-        if (system.validCluster(cluster) && cluster!=FAT_LAST) {
-            if (currentCluster+1 != cluster && isContiguous != NULL) {
-                *isContiguous = false;
-            }
-            if (visited.find(cluster) != visited.end()) {
-                cerr << "! Loop detected, " << currentCluster << " points to " << cluster << " that I already met" << endl;
-            } else {
-                stop = false;
-            }
-        }
-    } while (!stop);
-
-    return length;
+    return system.chainSize(cluster, isContiguous);
 }
@@ -5,6 +5,7 @@
 #include <set>
 #include <map>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 
@@ -25,27 +26,27 @@ class FatChains : public FatModule
         void chainsAnalysis();
 
         /**
-         * Recursive method to do an exploration and do the differential
-         * chains analysis
+         * Explores a directory and its subdirectories to do the differential
+         * chains analysis, the tree is walked with an explicit stack
          */
-        bool recursiveExploration(map<int, FatChain> &chains, set<int> &visited, int cluster, vector<FatEntry> *inputEntries=NULL);
+        bool recursiveExploration(vector<FatChain> &chains, set<int> &visited, int cluster, vector<FatEntry> *inputEntries=NULL);
 
         /**
-         * Find the chains from the FAT and return a map indexed
-         * by the first cluster of each chain
+         * Find the chains from the FAT and return them sorted by their
+         * first cluster
          */
-        map<int, FatChain> findChains();
+        vector<FatChain> findChains();
 
         /**
          * For each chain, we try to tell if it's a directory and run recursive
-         * exploration if it is
+         * exploration if it is, the orphaned chains are examined only once
          */
-        void exploreChains(map<int, FatChain> &chains, set<int> &visited);
+        void exploreChains(vector<FatChain> &chains, set<int> &visited);
 
         /**
          * Get chains that are orphaned
          */
-        list<FatChain> getOrphaned(map<int, FatChain> &chains);
+        list<FatChain> getOrphaned(vector<FatChain> &chains);
 
         /**
          * Display the orphaned chains
@@ -58,10 +59,49 @@ class FatChains : public FatModule
         int chainSize(int cluster, bool *isContiguous);
 
     protected:
+        /**
+         * A directory being explored
+         */
+        struct Exploration
+        {
+            int cluster;
+            vector<FatEntry> entries;
+            unsigned int index;
+            bool returning;
+            int child;
+            bool wasOrphaned;
+        };
+
         bool saveEntries;
         bool exploreDamaged;
         map<int, vector<FatEntry> > orphanEntries;
         map<int, FatEntry> clusterToEntry;
+
+        // Chains that were created and should be examined
+        set<int> pending;
+        // Explored clusters, and whether they had entries
+        map<int, bool> directories;
+        // Chains created while exploring, after the ones found in the FAT,
+        // by first cluster
+        unordered_map<int, int> created;
+
+        /**
+         * Position of the chain starting at a cluster, -1 if there is none
+         */
+        int findChain(vector<FatChain> &chains, int cluster);
+
+        /**
+         * Gets a chain, creating it if it does not exist; the reference is
+         * valid until the next chain is created
+         */
+        FatChain &getChain(vector<FatChain> &chains, int cluster);
+
+        /**
+         * Starts exploring a directory if it was not visited, adding it
+         * to the stack
+         */
+        bool enterDirectory(set<int> &visited, int cluster, vector<FatEntry> *inputEntries,
+                vector<Exploration> &stack);
 };
 
 #endif // _FATCAT_FATCHAINS_H
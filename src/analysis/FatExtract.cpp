@@ -44,5 +44,11 @@ void FatExtract::extract(unsigned int cluster, string directory, bool erased)
 {
     walkErased = erased;
     targetDirectory = directory;
+
+    // The extents of all the files are needed
+    if (system.cacheFits()) {
+        system.enableCache();
+    }
+
     walk(cluster);
 }
@@ -13,7 +13,14 @@ void FatFix::fix()
 {
     cout << "Searching for damaged files & directories" << endl;
     system.enableWrite();
+
+    // The broken chains are checked cluster by cluster
+    if (system.cacheFits()) {
+        system.enableCache();
+    }
+
     walk();
+    system.flush();
 }
         
 void FatFix::onEntry(FatEntry &parent, FatEntry &entry, string name)
@@ -0,0 +1,311 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <FatUtils.h>
+#include "FatOwners.h"
+
+using namespace std;
+
+bool FatOwners::compareExtents(const OwnedExtent &a, const OwnedExtent &b)
+{
+    if (a.start != b.start) {
+        return a.start < b.start;
+    }
+
+    return a.owner < b.owner;
+}
+
+FatOwners::FatOwners(FatSystem &system)
+    : FatWalk(system),
+    indexChains(true)
+{
+    walkErased = true;
+}
+
+void FatOwners::build(int cluster)
+{
+    owners.clear();
+    extents.clear();
+    starts.clear();
+
+    if (cluster == 0 && system.index.ownersCount()) {
+        load();
+    } else {
+        // The extents of all the chains are needed
+        if (indexChains && system.cacheFits()) {
+            system.enableCache();
+        }
+        walk(cluster);
+    }
+
+    sort(extents.begin(), extents.end(), compareExtents);
+    stable_sort(starts.begin(), starts.end());
+
+    reach.resize(extents.size());
+    unsigned long long highest = 0;
+    for (unsigned int i=0; i<extents.size(); i++) {
+        unsigned long long end = (unsigned long long)extents[i].start+extents[i].length;
+        if (end > highest) {
+            highest = end;
+        }
+        reach[i] = highest;
+    }
+}
+
+void FatOwners::load()
+{
+    FatIndex &index = system.index;
+    unsigned int count = index.ownersCount();
+
+    owners.resize(count);
+    for (unsigned int i=0; i<count; i++) {
+        Owner &owner = owners[i];
+        index.getOwner(i, owner.entry, owner.path, owner.parentName, owner.parentCluster);
+        starts.push_back(make_pair(owner.entry.cluster, (int)i));
+    }
+
+    if (indexChains) {
+        const FatIndexExtent *indexed = index.getExtents();
+        unsigned int total = index.extentsCount();
+
+        for (unsigned int i=0; i<total; i++) {
+            if (indexed[i].owner < count) {
+                OwnedExtent extent;
+                extent.start = indexed[i].start;
+                extent.length = indexed[i].length;
+                extent.owner = indexed[i].owner;
+                extents.push_back(extent);
+            }
+        }
+    }
+}
+
+void FatOwners::save(string filename)
+{
+    FatIndex &index = system.index;
+
+    index.record();
+    indexChains = true;
+    build();
+
+    vector<Owner>::iterator it;
+    for (it=owners.begin(); it!=owners.end(); it++) {
+        index.addOwner(it->entry, it->path, it->parentName, it->parentCluster);
+    }
+
+    vector<OwnedExtent>::iterator extent;
+    for (extent=extents.begin(); extent!=extents.end(); extent++) {
+        index.addExtent(extent->start, extent->length, extent->owner);
+    }
+
+    index.save(system, filename);
+}
+
+void FatOwners::onEntry(FatEntry &parent, FatEntry &entry, string name)
+{
+    int index = owners.size();
+    owners.push_back(Owner());
+    Owner &owner = owners.back();
+    owner.entry = entry;
+    owner.path.swap(name);
+
+    owner.parentName = parent.getFilename();
+    owner.parentCluster = parent.cluster;
+
+    starts.push_back(make_pair(entry.cluster, index));
+
+    // The walk starts with cluster 0 for the root directory
+    unsigned int cluster = entry.cluster;
+    if (&entry == &parent && cluster == 0 && system.type == FAT32) {
+        cluster = system.rootDirectory;
+    }
+
+    // The chains of erased entries were freed
+    if (!indexChains || entry.isErased() || cluster < 2) {
+        return;
+    }
+
+    vector<FatExtent> chain;
+    system.getExtents(cluster, chain);
+
+    vector<FatExtent>::iterator it;
+    for (it=chain.begin(); it!=chain.end(); it++) {
+        OwnedExtent extent;
+        extent.start = it->start;
+        extent.length = it->length;
+        extent.owner = index;
+        extents.push_back(extent);
+    }
+}
+
+vector<int> FatOwners::startingAt(unsigned int cluster)
+{
+    vector<int> result;
+    vector<pair<unsigned int, int> >::iterator it;
+
+    it = lower_bound(starts.begin(), starts.end(), make_pair(cluster, -1));
+    for (; it!=starts.end() && it->first == cluster; it++) {
+        result.push_back(it->second);
+    }
+
+    return result;
+}
+
+vector<int> FatOwners::owning(unsigned int cluster)
+{
+    vector<int> result;
+    OwnedExtent key;
+    key.start = cluster;
+    key.length = 0;
+    key.owner = owners.size();
+
+    // Extents starting after the cluster can't contain it, and the ones
+    // before are looked at until none of them reaches it
+    int i = upper_bound(extents.begin(), extents.end(), key, compareExtents)-extents.begin()-1;
+    for (; i>=0 && reach[i]>cluster; i--) {
+        if ((unsigned long long)extents[i].start+extents[i].length > cluster) {
+            result.push_back(extents[i].owner);
+        }
+    }
+
+    sort(result.begin(), result.end());
+    result.erase(unique(result.begin(), result.end()), result.end());
+
+    return result;
+}
+
+void FatOwners::describe(string label, unsigned int cluster)
+{
+    vector<int> found = owning(cluster);
+
+    if (found.empty()) {
+        if (system.freeCluster(cluster)) {
+            cout << label << ": free" << endl;
+        } else {
+            cout << label << ": allocated, not owned by any entry" << endl;
+        }
+        return;
+    }
+
+    vector<int>::iterator it;
+    for (it=found.begin(); it!=found.end(); it++) {
+        Owner &owner = owners[*it];
+        cout << label << ": " << owner.path;
+        if (owner.entry.sector) {
+            cout << " (entry at sector " << owner.entry.sector << ", offset " << owner.entry.offset << ")";
+        }
+        cout << endl;
+    }
+}
+
+void FatOwners::queryCluster(unsigned long long cluster)
+{
+    ostringstream label;
+    label << "Cluster " << cluster;
+
+    if (cluster < 2 || cluster >= system.totalClusters) {
+        cout << label.str() << ": outside of the data area" << endl;
+    } else {
+        describe(label.str(), cluster);
+    }
+}
+
+void FatOwners::querySector(unsigned long long sector)
+{
+    ostringstream label;
+    label << "Sector " << sector;
+    locate(label.str(), "", sector);
+}
+
+void FatOwners::queryOffset(unsigned long long offset)
+{
+    ostringstream label;
+    unsigned long long sector = offset/system.bytesPerSector;
+    ostringstream details;
+    label << "Offset " << offset;
+    details << "sector " << sector;
+    locate(label.str(), details.str(), sector);
+}
+
+void FatOwners::locate(string label, string details, unsigned long long sector)
+{
+    unsigned long long fatsEnd = system.fatStart+system.fats*system.sectorsPerFat;
+    unsigned long long dataArea = system.clusterAddress(2);
+    ostringstream oss;
+    oss << label;
+
+    if (sector >= dataArea && sector < system.totalSectors) {
+        unsigned long long cluster = 2+(sector-dataArea)/system.sectorsPerCluster;
+        oss << " (" << details << (details == "" ? "" : ", ") << "cluster " << cluster << ")";
+
+        if (cluster >= system.totalClusters) {
+            cout << oss.str() << ": after the last cluster" << endl;
+        } else {
+            describe(oss.str(), cluster);
+        }
+        return;
+    }
+
+    if (details != "") {
+        oss << " (" << details << ")";
+    }
+    cout << oss.str() << ": ";
+
+    if (sector >= system.totalSectors) {
+        cout << "outside of the disk" << endl;
+    } else if (sector < system.fatStart) {
+        cout << "reserved sectors" << endl;
+    } else if (sector < fatsEnd) {
+        cout << "FAT " << (1+(sector-system.fatStart)/system.sectorsPerFat) << endl;
+    } else {
+        cout << "root directory" << endl;
+    }
+}
+
+void FatOwners::queryFile(string filename)
+{
+    ifstream file(filename.c_str());
+    if (!file) {
+        ostringstream oss;
+        oss << "Unable to open file " << filename << " for reading";
+        throw oss.str();
+    }
+
+    string line;
+    while (getline(file, line)) {
+        istringstream words(line);
+        string kind;
+        unsigned long long value;
+
+        if (!(words >> kind) || kind[0] == '#') {
+            continue;
+        }
+
+        if (kind == "cluster" || kind == "sector" || kind == "offset") {
+            if (!(words >> value)) {
+                cerr << "! Bad query: " << line << endl;
+                continue;
+            }
+        } else {
+            char *end;
+            value = strtoull(kind.c_str(), &end, 10);
+            if (*end != '\0') {
+                cerr << "! Bad query: " << line << endl;
+                continue;
+            }
+            kind = "sector";
+        }
+
+        if (kind == "cluster") {
+            queryCluster(value);
+        } else if (kind == "sector") {
+            querySector(value);
+        } else {
+            queryOffset(value);
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef _FATCAT_FATOWNERS_H
+#define _FATCAT_FATOWNERS_H
+
+#include <string>
+#include <vector>
+#include <core/FatSystem.h>
+#include "FatWalk.h"
+
+using namespace std;
+
+/**
+ * Index of the entries owning the clusters, built by walking the tree once
+ *
+ * The extents of all the chains are kept in a vector sorted by first
+ * cluster, so that a query is a binary search
+ */
+class FatOwners : public FatWalk
+{
+    public:
+        FatOwners(FatSystem &system);
+
+        /**
+         * Walks the tree from the given directory to build the index, the
+         * whole tree is taken from the index file if there is one
+         */
+        void build(int cluster = 0);
+
+        /**
+         * Builds the index and writes it with the FAT and the directories
+         * to an index file
+         */
+        void save(string filename);
+
+        /**
+         * Entries whose chain starts at the given cluster
+         */
+        vector<int> startingAt(unsigned int cluster);
+
+        /**
+         * Entries whose chain contains the given cluster
+         */
+        vector<int> owning(unsigned int cluster);
+
+        /**
+         * Displays the owners of a cluster, of a sector, or of a byte offset
+         */
+        void queryCluster(unsigned long long cluster);
+        void querySector(unsigned long long sector);
+        void queryOffset(unsigned long long offset);
+
+        /**
+         * Runs the queries listed in a file, one per line: "cluster N",
+         * "sector N", "offset N", or a sector number alone
+         */
+        void queryFile(string filename);
+
+    protected:
+        struct Owner
+        {
+            FatEntry entry;
+            string path;
+            string parentName;
+            unsigned int parentCluster;
+        };
+
+        struct OwnedExtent
+        {
+            unsigned int start;
+            unsigned int length;
+            int owner;
+        };
+
+        // Only the first clusters are indexed if false
+        bool indexChains;
+
+        vector<Owner> owners;
+        vector<OwnedExtent> extents;
+        // Highest end of the extents up to each one
+        vector<unsigned long long> reach;
+        // First clusters of the chains, with their owner
+        vector<pair<unsigned int, int> > starts;
+
+        static bool compareExtents(const OwnedExtent &a, const OwnedExtent &b);
+
+        /**
+         * Takes the owners from the index file
+         */
+        void load();
+
+        /**
+         * Displays what a sector is used for, after a label and some
+         * details put in parentheses
+         */
+        void locate(string label, string details, unsigned long long sector);
+
+        /**
+         * Displays the owners of a data cluster, after a label
+         */
+        void describe(string label, unsigned int cluster);
+
+        virtual void onEntry(FatEntry &parent, FatEntry &entry, string name);
+};
+
+#endif // _FATCAT_FATOWNERS_H
@@ -5,30 +5,50 @@
 using namespace std;
 
 FatSearch::FatSearch(FatSystem &system)
-    : FatWalk(system),
-    searchCluster(-1),
+    : FatOwners(system),
+    searchCluster(0),
     found(0)
 {
-    walkErased = true;
+    indexChains = false;
 }
 
 void FatSearch::search(int cluster)
 {
     cout << "Searching for an entry referencing " << cluster << " ..." << endl;
     searchCluster = cluster;
-    walk();
+    found = 0;
+
+    if (system.index.ownersCount()) {
+        // The owners are looked up in the index file
+        build();
+
+        vector<int> starting = startingAt(cluster);
+        vector<int>::iterator it;
+        for (it=starting.begin(); it!=starting.end(); it++) {
+            Owner &owner = owners[*it];
+            display(owner.entry, owner.path, owner.parentName, owner.parentCluster);
+        }
+    } else {
+        walk();
+    }
+
     if (!found) {
         cout << "No entry found" << endl;
     }
 }
-        
+
+void FatSearch::display(FatEntry &entry, string name, string parentName, unsigned int parentCluster)
+{
+    cout << "Found " << name << " in directory " << parentName << " (" << parentCluster << ")" << endl;
+    vector<FatEntry> tmp;
+    tmp.push_back(entry);
+    system.list(tmp);
+    found++;
+}
+
 void FatSearch::onEntry(FatEntry &parent, FatEntry &entry, string name)
 {
     if (entry.cluster == searchCluster) {
-        cout << "Found " << name << " in directory " << parent.getFilename() << " (" << parent.cluster << ")" << endl;
-        vector<FatEntry> tmp;
-        tmp.push_back(entry);
-        system.list(tmp);
-        found++;
+        display(entry, name, parent.getFilename(), parent.cluster);
     }
 }
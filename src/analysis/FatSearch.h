@@ -2,13 +2,16 @@
 #define _FATCAT_FATSEARCH_H
 
 #include <string>
-#include <set>
 #include <core/FatSystem.h>
-#include "FatWalk.h"
+#include "FatOwners.h"
 
 using namespace std;
 
-class FatSearch : public FatWalk
+/**
+ * Searches the entries whose chain starts at a cluster, they are printed
+ * while walking the tree, or looked up in the index file if there is one
+ */
+class FatSearch : public FatOwners
 {
     public:
         FatSearch(FatSystem &system);
@@ -19,9 +22,11 @@ class FatSearch : public FatWalk
         void search(int cluster);
 
     protected:
-        int searchCluster;
+        unsigned int searchCluster;
         int found;
-        
+
+        void display(FatEntry &entry, string name, string parentName, unsigned int parentCluster);
+
         virtual void onEntry(FatEntry &parent, FatEntry &entry, string name);
 };
 
@@ -1,16 +1,39 @@
+#include <thread>
+
 #include "FatWalk.h"
+
+/**
+ * Marks a cluster as visited, returns false if it already was or if it
+ * is outside the disk
+ */
+static bool claimCluster(vector<atomic<uint32_t> > &visited, unsigned int cluster, unsigned long long total)
+{
+    if (cluster >= total) {
+        return false;
+    }
+
+    uint32_t bit = 1u << (cluster%32);
+
+    return !(visited[cluster/32].fetch_or(bit) & bit);
+}
         
 FatWalk::FatWalk(FatSystem &system)
     : FatModule(system),
-    walkErased(false)
+    walkErased(false),
+    threads(1)
+{
+}
+
+void FatWalk::setThreads(int threads_)
 {
+    threads = threads_ > 0 ? threads_ : 1;
 }
 
 void FatWalk::walk(int cluster)
 {
     FatEntry root;
 
-    if (cluster == system.rootDirectory) {
+    if ((unsigned int)cluster == system.rootDirectory) {
         root = system.rootEntry();
     } else {
         root.cluster = cluster;
@@ -18,8 +41,65 @@ void FatWalk::walk(int cluster)
         root.longName = "/";
     }
     set<int> visited;
+
+    if (threads > 1) {
+        readTree(root.cluster);
+    }
+
     onEntry(root, root, "/");
     doWalk(visited, root, "/");
+    listings.clear();
+}
+
+void FatWalk::readTree(unsigned int cluster)
+{
+    FatWorkQueue queue(threads);
+    vector<atomic<uint32_t> > visited(system.totalClusters/32+1);
+    vector<thread> workers;
+    mutex lock;
+
+    listings.clear();
+    claimCluster(visited, cluster, system.totalClusters);
+    queue.push(0, cluster);
+
+    for (int i=0; i<threads; i++) {
+        workers.push_back(thread(&FatWalk::readWorker, this, ref(queue), ref(visited), ref(lock), i));
+    }
+    for (int i=0; i<threads; i++) {
+        workers[i].join();
+    }
+}
+
+void FatWalk::readWorker(FatWorkQueue &queue, vector<atomic<uint32_t> > &visited, mutex &lock, int worker)
+{
+    unsigned int cluster;
+
+    while (queue.pop(worker, cluster)) {
+        vector<FatEntry> entries = system.getEntries(cluster);
+        vector<FatEntry>::iterator it;
+
+        // Same filter as doWalk()
+        for (it=entries.begin(); it!=entries.end(); it++) {
+            FatEntry &entry = *it;
+
+            if ((!walkErased) && entry.isErased()) {
+                continue;
+            }
+
+            if (entry.isDirectory() && entry.getFilename() != "." && entry.getFilename() != "..") {
+                if (claimCluster(visited, entry.cluster, system.totalClusters)) {
+                    queue.push(worker, entry.cluster);
+                }
+            }
+        }
+
+        {
+            lock_guard<mutex> guard(lock);
+            listings[cluster].swap(entries);
+        }
+
+        queue.done();
+    }
 }
 
 void FatWalk::doWalk(set<int> &visited, FatEntry &currentEntry, string name)
@@ -32,7 +112,13 @@ void FatWalk::doWalk(set<int> &visited, FatEntry &currentEntry, string name)
 
     visited.insert(cluster);
 
-    vector<FatEntry> entries = system.getEntries(cluster);
+    vector<FatEntry> entries;
+    map<unsigned int, vector<FatEntry> >::iterator listing = listings.find(cluster);
+    if (listing != listings.end()) {
+        entries.swap(listing->second);
+    } else {
+        entries = system.getEntries(cluster);
+    }
     vector<FatEntry>::iterator it;
 
     for (it=entries.begin(); it!=entries.end(); it++) {
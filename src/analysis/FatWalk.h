@@ -1,10 +1,15 @@
 #ifndef _FATCAT_FATWALK_H
 #define _FATCAT_FATWALK_H
 
+#include <atomic>
+#include <map>
+#include <mutex>
 #include <string>
 #include <set>
+#include <stdint.h>
 #include <core/FatSystem.h>
 #include <core/FatModule.h>
+#include <core/FatWorkQueue.h>
 
 using namespace std;
 
@@ -14,6 +19,11 @@ using namespace std;
  *
  * This can be overloaded to perform actions on each nodes of the
  * filesystem
+ *
+ * When using several threads, the directories are all read first, in
+ * parallel, then the callbacks are called from the calling thread in the
+ * same order as with a single one; they are never called concurrently,
+ * but the changes they do on the disk are not seen when reading the tree
  */
 class FatWalk : public FatModule
 {
@@ -23,8 +33,23 @@ class FatWalk : public FatModule
         void walk(int cluster = 0);
         void doWalk(set<int> &visited, FatEntry &entry, string name);
 
+        /**
+         * Number of threads reading the directories
+         */
+        void setThreads(int threads);
+
     protected:
         bool walkErased;
+        int threads;
+
+        // Directories read ahead, by cluster
+        map<unsigned int, vector<FatEntry> > listings;
+
+        /**
+         * Reads all the directories reachable from a cluster
+         */
+        void readTree(unsigned int cluster);
+        void readWorker(FatWorkQueue &queue, vector<atomic<uint32_t> > &visited, mutex &lock, int worker);
         
         virtual void onDirectory(FatEntry &parent, FatEntry &entr, string name);
         virtual void onEntry(FatEntry &parent, FatEntry &entry, string name);
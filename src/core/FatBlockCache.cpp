@@ -0,0 +1,97 @@
+#include <string.h>
+
+#include "FatBlockCache.h"
+
+using namespace std;
+
+FatBlockCache::FatBlockCache()
+    : hits(0),
+    misses(0),
+    capacity(0)
+{
+}
+
+void FatBlockCache::setCapacity(unsigned long long capacity_)
+{
+    capacity = capacity_;
+
+    while (blocks.size() > capacity) {
+        index.erase(blocks.back().first);
+        blocks.pop_back();
+    }
+}
+
+bool FatBlockCache::enabled()
+{
+    return capacity != 0;
+}
+
+const vector<char> *FatBlockCache::get(unsigned long long block)
+{
+    map<unsigned long long, BlockList::iterator>::iterator it = index.find(block);
+
+    if (it == index.end()) {
+        misses++;
+        return NULL;
+    }
+
+    // Most recently used blocks are kept at the front
+    hits++;
+    blocks.splice(blocks.begin(), blocks, it->second);
+
+    return &it->second->second;
+}
+
+void FatBlockCache::put(unsigned long long block, const vector<char> &data)
+{
+    if (!enabled()) {
+        return;
+    }
+
+    map<unsigned long long, BlockList::iterator>::iterator it = index.find(block);
+    if (it != index.end()) {
+        it->second->second = data;
+        blocks.splice(blocks.begin(), blocks, it->second);
+        return;
+    }
+
+    if (blocks.size() >= capacity) {
+        // Recycling the least recently used block
+        index.erase(blocks.back().first);
+        blocks.splice(blocks.begin(), blocks, --blocks.end());
+        blocks.front().first = block;
+        blocks.front().second = data;
+    } else {
+        blocks.push_front(make_pair(block, data));
+    }
+
+    index[block] = blocks.begin();
+}
+
+void FatBlockCache::update(unsigned long long address, const char *buffer, int size, int sectorSize)
+{
+    if (blocks.empty() || size <= 0) {
+        return;
+    }
+
+    unsigned long long first = address/FAT_CACHE_BLOCK;
+    unsigned long long last = (address+size-1)/FAT_CACHE_BLOCK;
+
+    for (unsigned long long block=first; block<=last; block++) {
+        map<unsigned long long, BlockList::iterator>::iterator it = index.find(block);
+        if (it == index.end()) {
+            continue;
+        }
+
+        unsigned long long start = block*FAT_CACHE_BLOCK;
+        unsigned long long from = start > address ? start : address;
+        unsigned long long to = start+FAT_CACHE_BLOCK < address+size ? start+FAT_CACHE_BLOCK : address+size;
+
+        memcpy(&it->second->second[(from-start)*sectorSize], buffer+(from-address)*sectorSize, (to-from)*sectorSize);
+    }
+}
+
+unsigned long long FatBlockCache::size()
+{
+    return blocks.size();
+}
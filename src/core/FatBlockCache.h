@@ -0,0 +1,60 @@
+#ifndef _FATCAT_FATBLOCKCACHE_H
+#define _FATCAT_FATBLOCKCACHE_H
+
+#include <list>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+// Number of sectors in a cached block
+#define FAT_CACHE_BLOCK     8
+
+// Reads bigger than this number of sectors bypass the cache
+#define FAT_CACHE_MAX_READ  128
+
+/**
+ * A bounded least recently used cache of fixed-size sector blocks,
+ * indexed by block number (sector address / FAT_CACHE_BLOCK)
+ */
+class FatBlockCache
+{
+    public:
+        FatBlockCache();
+
+        /**
+         * Sets the maximum number of blocks kept, 0 disables the cache
+         */
+        void setCapacity(unsigned long long capacity);
+        bool enabled();
+
+        /**
+         * Returns the given block, or NULL if it's not cached
+         */
+        const vector<char> *get(unsigned long long block);
+
+        /**
+         * Adds a block, evicting the least recently used one if full
+         */
+        void put(unsigned long long block, const vector<char> &data);
+
+        /**
+         * Updates the cached blocks overlapping some written sectors
+         */
+        void update(unsigned long long address, const char *buffer, int size, int sectorSize);
+
+        unsigned long long size();
+
+        // Statistics
+        unsigned long long hits;
+        unsigned long long misses;
+
+    protected:
+        typedef list<pair<unsigned long long, vector<char> > > BlockList;
+
+        unsigned long long capacity;
+        BlockList blocks;
+        map<unsigned long long, BlockList::iterator> index;
+};
+
+#endif // _FATCAT_FATBLOCKCACHE_H
@@ -0,0 +1,204 @@
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <FatUtils.h>
+#include "FatCodec.h"
+
+using namespace std;
+
+template<>
+void FatCodec<32>::decode(const char *data, uint32_t *output, unsigned int count)
+{
+    const unsigned char *buffer = (const unsigned char *)data;
+    unsigned int i = 0;
+
+#ifdef __SSE2__
+    // Masking the 4 high bits, end of chains are turned to all ones
+    const __m128i values = _mm_set1_epi32(mask);
+    const __m128i limit = _mm_set1_epi32(last-1);
+    for (; i+4<=count; i+=4) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(buffer+4*i)), values);
+        _mm_storeu_si128((__m128i *)(output+i), _mm_or_si128(v, _mm_cmpgt_epi32(v, limit)));
+    }
+#endif
+    for (; i<count; i++) {
+        output[i] = decodeValue(FAT_READ_LONG(buffer, 4*i));
+    }
+}
+
+template<>
+void FatCodec<16>::decode(const char *data, uint32_t *output, unsigned int count)
+{
+    const unsigned char *buffer = (const unsigned char *)data;
+    unsigned int i = 0;
+
+#ifdef __SSE2__
+    // Widening 8 entries to 32-bit at a time
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i limit = _mm_set1_epi32(last-1);
+    for (; i+8<=count; i+=8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buffer+2*i));
+        __m128i low = _mm_unpacklo_epi16(v, zero);
+        __m128i high = _mm_unpackhi_epi16(v, zero);
+        _mm_storeu_si128((__m128i *)(output+i), _mm_or_si128(low, _mm_cmpgt_epi32(low, limit)));
+        _mm_storeu_si128((__m128i *)(output+i+4), _mm_or_si128(high, _mm_cmpgt_epi32(high, limit)));
+    }
+#endif
+    for (; i<count; i++) {
+        output[i] = decodeValue(FAT_READ_SHORT(buffer, 2*i));
+    }
+}
+
+template<>
+void FatCodec<12>::decode(const char *data, uint32_t *output, unsigned int count)
+{
+    const unsigned char *buffer = (const unsigned char *)data;
+    unsigned int i = 0;
+
+#ifdef __SSE2__
+    // Two entries are packed in three bytes, the 64-bit lanes get the
+    // 8 bytes of 4 entries; their 12-bit fields are moved to 32-bit ones,
+    // the 2 following entries being read too
+    const __m128i low = _mm_set1_epi64x(0xfffULL);
+    const __m128i high = _mm_set1_epi64x(0xfffULL<<32);
+    const __m128i limit = _mm_set1_epi32(last-1);
+    for (; i+10<=count; i+=8) {
+        const unsigned char *p = buffer + 3*(i/2);
+        __m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)p),
+                _mm_loadl_epi64((const __m128i *)(p+6)));
+        __m128i first = _mm_or_si128(_mm_and_si128(v, low),
+                _mm_and_si128(_mm_slli_epi64(v, 20), high));
+        __m128i second = _mm_or_si128(_mm_and_si128(_mm_srli_epi64(v, 24), low),
+                _mm_and_si128(_mm_srli_epi64(v, 4), high));
+        __m128i a = _mm_unpacklo_epi64(first, second);
+        __m128i b = _mm_unpackhi_epi64(first, second);
+        _mm_storeu_si128((__m128i *)(output+i), _mm_or_si128(a, _mm_cmpgt_epi32(a, limit)));
+        _mm_storeu_si128((__m128i *)(output+i+4), _mm_or_si128(b, _mm_cmpgt_epi32(b, limit)));
+    }
+#endif
+    // Two entries are packed in three bytes
+    for (; i+2<=count; i+=2) {
+        const unsigned char *p = buffer + 3*(i/2);
+        uint32_t pair = p[0] | (p[1]<<8) | (p[2]<<16);
+        output[i] = decodeValue(pair);
+        output[i+1] = decodeValue(pair>>12);
+    }
+    if (i < count) {
+        output[i] = decodeValue(FAT_READ_SHORT(buffer, 3*(i/2)));
+    }
+}
+
+/**
+ * The free entries are counted on the raw data, the comparisons give -1
+ * for each of them, accumulated in the 32-bit lanes of a vector
+ */
+template<>
+unsigned int FatCodec<32>::countFree(const char *data, unsigned int count)
+{
+    const unsigned char *buffer = (const unsigned char *)data;
+    unsigned int free = 0;
+    unsigned int i = 0;
+
+#ifdef __AVX2__
+    const __m256i values = _mm256_set1_epi32(mask);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sum = _mm256_setzero_si256();
+    for (; i+8<=count; i+=8) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(buffer+4*i)), values);
+        sum = _mm256_sub_epi32(sum, _mm256_cmpeq_epi32(v, zero));
+    }
+    uint32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+    for (int k=0; k<8; k++) {
+        free += lanes[k];
+    }
+#elif defined(__SSE2__)
+    const __m128i values = _mm_set1_epi32(mask);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_setzero_si128();
+    for (; i+4<=count; i+=4) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(buffer+4*i)), values);
+        sum = _mm_sub_epi32(sum, _mm_cmpeq_epi32(v, zero));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, sum);
+    free += lanes[0]+lanes[1]+lanes[2]+lanes[3];
+#endif
+    for (; i<count; i++) {
+        free += ((FAT_READ_LONG(buffer, 4*i))&mask) == 0;
+    }
+
+    return free;
+}
+
+/**
+ * Same with 16-bit lanes, the sums are taken every 0xffff iterations so
+ * that they don't overflow
+ */
+template<>
+unsigned int FatCodec<16>::countFree(const char *data, unsigned int count)
+{
+    const unsigned char *buffer = (const unsigned char *)data;
+    unsigned int free = 0;
+    unsigned int i = 0;
+
+#ifdef __AVX2__
+    const __m256i zero = _mm256_setzero_si256();
+    while (i+16 <= count) {
+        __m256i sum = _mm256_setzero_si256();
+        unsigned int end = i+16*0xffffu < count ? i+16*0xffffu : count;
+        for (; i+16<=end; i+=16) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(buffer+2*i));
+            sum = _mm256_sub_epi16(sum, _mm256_cmpeq_epi16(v, zero));
+        }
+        uint16_t lanes[16];
+        _mm256_storeu_si256((__m256i *)lanes, sum);
+        for (int k=0; k<16; k++) {
+            free += lanes[k];
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    while (i+8 <= count) {
+        __m128i sum = _mm_setzero_si128();
+        unsigned int end = i+8*0xffffu < count ? i+8*0xffffu : count;
+        for (; i+8<=end; i+=8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(buffer+2*i));
+            sum = _mm_sub_epi16(sum, _mm_cmpeq_epi16(v, zero));
+        }
+        uint16_t lanes[8];
+        _mm_storeu_si128((__m128i *)lanes, sum);
+        for (int k=0; k<8; k++) {
+            free += lanes[k];
+        }
+    }
+#endif
+    for (; i<count; i++) {
+        free += FAT_READ_SHORT(buffer, 2*i) == 0;
+    }
+
+    return free;
+}
+
+template<>
+unsigned int FatCodec<12>::countFree(const char *data, unsigned int count)
+{
+    // The tables are small, the entries are not aligned
+    const unsigned char *buffer = (const unsigned char *)data;
+    unsigned int free = 0;
+    unsigned int i = 0;
+
+    for (; i+2<=count; i+=2) {
+        const unsigned char *p = buffer + 3*(i/2);
+        uint32_t pair = p[0] | (p[1]<<8) | (p[2]<<16);
+        free += ((pair&0xfff) == 0) + ((pair>>12) == 0);
+    }
+    if (i < count) {
+        free += (FAT_READ_SHORT(buffer, 3*(i/2))&0xfff) == 0;
+    }
+
+    return free;
+}
@@ -0,0 +1,168 @@
+#ifndef _FATCAT_FATCODEC_H
+#define _FATCAT_FATCODEC_H
+
+#include <stdint.h>
+#include <vector>
+#include <FatUtils.h>
+#include "FatSystem.h"
+
+using namespace std;
+
+// Number of entries read at once by FatCodec::read() and readFree()
+#define FAT_CODEC_CHUNK     65536
+
+/**
+ * Reading and writing the entries of a 12, 16 or 32 bits FAT
+ *
+ * The width is known at compile time, FatSystem selects the codec once
+ * in init() and the loops going through a whole table are instantiated
+ * for each width
+ */
+template<int Bits>
+class FatCodec
+{
+    public:
+        // Bits of the values, the highest ones mark the ends of chains
+        static const uint32_t mask = Bits == 32 ? 0x0fffffff : (1u<<Bits)-1;
+        static const uint32_t last = mask&~0xfu;
+
+        // Bytes to read to get an entry, FAT12 ones take a byte and a half
+        static const unsigned int size = Bits == 12 ? 2 : Bits/8;
+
+        /**
+         * Byte offset of the entry of a cluster in a FAT
+         */
+        static unsigned long long offset(unsigned int cluster)
+        {
+            if (Bits == 12) {
+                return cluster + cluster/2ULL;
+            }
+
+            return (unsigned long long)cluster*(Bits/8);
+        }
+
+        /**
+         * Raw value of the entry of a cluster, the buffer starting at
+         * its offset
+         */
+        static uint32_t get(const char *buffer, unsigned int cluster)
+        {
+            if (Bits == 32) {
+                return FAT_READ_LONG(buffer, 0);
+            }
+
+            uint32_t value = FAT_READ_SHORT(buffer, 0);
+            if (Bits == 12 && (cluster&1)) {
+                value >>= 4;
+            }
+
+            return value;
+        }
+
+        /**
+         * Changes the entry of a cluster, the buffer starting at its offset
+         */
+        static void set(char *buffer, unsigned int cluster, uint32_t next)
+        {
+            if (Bits == 12) {
+                if (cluster&1) {
+                    buffer[0] = ((next&0x0f)<<4)|(buffer[0]&0x0f);
+                    buffer[1] = (next>>4)&0xff;
+                } else {
+                    buffer[0] = next&0xff;
+                    buffer[1] = (buffer[1]&0xf0)|((next>>8)&0x0f);
+                }
+            } else {
+                for (int i=0; i<Bits/8; i++) {
+                    buffer[i] = (next>>(8*i))&0xff;
+                }
+            }
+        }
+
+        /**
+         * Next cluster from a raw value, FAT_LAST for the ends of chains
+         */
+        static uint32_t decodeValue(uint32_t value)
+        {
+            value &= mask;
+            return value >= last ? FAT_LAST : value;
+        }
+
+        /**
+         * Decodes count raw entries, the first one being byte-aligned
+         */
+        static void decode(const char *data, uint32_t *output, unsigned int count);
+
+        /**
+         * Number of free (zero) entries among count raw ones, the first
+         * one being byte-aligned
+         */
+        static unsigned int countFree(const char *data, unsigned int count);
+
+        /**
+         * Decodes at most count entries of the n-th FAT of a system,
+         * starting from a cluster that is even for FAT12; returns the
+         * number of decoded entries
+         */
+        static unsigned int read(FatSystem &system, int fat, unsigned int cluster,
+                uint32_t *output, unsigned int count, vector<char> &buffer)
+        {
+            const char *data = raw(system, fat, cluster, count, buffer);
+            if (data != NULL) {
+                decode(data, output, count);
+            }
+
+            return data == NULL ? 0 : count;
+        }
+
+        /**
+         * Same, counting the free entries instead of decoding them, count
+         * is set to the number of entries read
+         */
+        static unsigned int readFree(FatSystem &system, int fat, unsigned int cluster,
+                unsigned int &count, vector<char> &buffer)
+        {
+            const char *data = raw(system, fat, cluster, count, buffer);
+
+            return data == NULL ? 0 : countFree(data, count);
+        }
+
+        /**
+         * Raw entries of some clusters of a FAT, starting at the byte of
+         * the given cluster; count is lowered to the number of entries
+         * left, NULL if there is none
+         */
+        static const char *raw(FatSystem &system, int fat, unsigned int cluster,
+                unsigned int &count, vector<char> &buffer)
+        {
+            if (cluster >= system.totalClusters) {
+                count = 0;
+                return NULL;
+            }
+            if (count > system.totalClusters-cluster) {
+                count = system.totalClusters-cluster;
+            }
+
+            unsigned long long start = offset(cluster);
+            unsigned long long end = offset(cluster+count-1)+size;
+            unsigned long long first = start/system.bytesPerSector;
+            unsigned long long sectors = (end+system.bytesPerSector-1)/system.bytesPerSector-first;
+
+            const char *data = system.readData(system.fatStart+system.sectorsPerFat*fat+first, sectors, buffer);
+            if (data == NULL) {
+                count = 0;
+                return NULL;
+            }
+
+            return data+start%system.bytesPerSector;
+        }
+};
+
+template<> void FatCodec<12>::decode(const char *data, uint32_t *output, unsigned int count);
+template<> void FatCodec<16>::decode(const char *data, uint32_t *output, unsigned int count);
+template<> void FatCodec<32>::decode(const char *data, uint32_t *output, unsigned int count);
+template<> unsigned int FatCodec<12>::countFree(const char *data, unsigned int count);
+template<> unsigned int FatCodec<16>::countFree(const char *data, unsigned int count);
+template<> unsigned int FatCodec<32>::countFree(const char *data, unsigned int count);
+
+#endif // _FATCAT_FATCODEC_H
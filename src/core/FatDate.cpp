@@ -12,7 +12,7 @@ FatDate::FatDate()
 {
 }
 
-FatDate::FatDate(char *buffer)
+FatDate::FatDate(const char *buffer)
 {
     int H = FAT_READ_SHORT(buffer, 0);
     int D = FAT_READ_SHORT(buffer, 2);
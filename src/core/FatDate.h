@@ -9,7 +9,7 @@ class FatDate
 {
     public:
         FatDate();
-        FatDate(char *buffer);
+        FatDate(const char *buffer);
 
         int h, i, s;
         int y, m, d;
@@ -0,0 +1,39 @@
+#include <FatUtils.h>
+#include "FatDirectoryCache.h"
+
+using namespace std;
+
+FatDirectoryCache::Directory *FatDirectoryCache::get(unsigned int cluster)
+{
+    unordered_map<unsigned int, Directory>::iterator it = directories.find(cluster);
+
+    if (it == directories.end()) {
+        return NULL;
+    }
+
+    return &it->second;
+}
+
+FatDirectoryCache::Directory &FatDirectoryCache::put(unsigned int cluster, vector<FatEntry> &entries)
+{
+    Directory &directory = directories[cluster];
+    directory.entries.swap(entries);
+    directory.names.clear();
+
+    // Names are folded once, when the directory is read
+    for (unsigned int i=0; i<directory.entries.size(); i++) {
+        directory.names[strtolower(directory.entries[i].getFilename())].push_back(i);
+    }
+
+    return directory;
+}
+
+void FatDirectoryCache::clear()
+{
+    directories.clear();
+}
+
+unsigned long long FatDirectoryCache::size()
+{
+    return directories.size();
+}
@@ -0,0 +1,47 @@
+#ifndef _FATCAT_FATDIRECTORYCACHE_H
+#define _FATCAT_FATDIRECTORYCACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "FatEntry.h"
+
+using namespace std;
+
+/**
+ * Listings of the directories used to resolve paths, by cluster, with
+ * their entries indexed by lowercased name so that a lookup does not
+ * scan the directory
+ */
+class FatDirectoryCache
+{
+    public:
+        struct Directory
+        {
+            vector<FatEntry> entries;
+            // Positions of the entries having each name, in order
+            unordered_map<string, vector<unsigned int> > names;
+        };
+
+        /**
+         * Returns the given directory, or NULL if it's not cached
+         */
+        Directory *get(unsigned int cluster);
+
+        /**
+         * Adds a directory, the entries are taken from the given vector
+         */
+        Directory &put(unsigned int cluster, vector<FatEntry> &entries);
+
+        /**
+         * Forgets all the directories, when the disk is written
+         */
+        void clear();
+
+        unsigned long long size();
+
+    protected:
+        unordered_map<unsigned int, Directory> directories;
+};
+
+#endif // _FATCAT_FATDIRECTORYCACHE_H
@@ -10,18 +10,26 @@
 using namespace std;
 
 FatEntry::FatEntry()
-    : hasData(false),
+    : attributes(0),
+      cluster(0),
+      size(0),
       sector(0),
-      offset(0)
+      offset(0),
+      hasData(false)
 {
+    memset(data, 0, sizeof(data));
 }
 
-void FatEntry::setData(string data_)
+void FatEntry::setData(const char *buffer)
 {
     hasData = true;
-    data = data_;
+    memcpy(data, buffer, sizeof(data));
+
+    attributes = data[FAT_ATTRIBUTES];
+    size = (FAT_READ_LONG(data, FAT_FILESIZE))&0xffffffff;
+    cluster = (FAT_READ_SHORT(data, FAT_CLUSTER_LOW)&0xffff) | (FAT_READ_SHORT(data, FAT_CLUSTER_HIGH)<<16);
 }
-        
+
 void FatEntry::updateData()
 {
     data[FAT_ATTRIBUTES] = attributes&0xff;
@@ -29,15 +37,30 @@ void FatEntry::updateData()
     FAT_WRITE_SHORT(data, FAT_CLUSTER_LOW, cluster&0xffff);
     FAT_WRITE_SHORT(data, FAT_CLUSTER_HIGH, (cluster>>16)&0xffff);
 }
-        
+
+string FatEntry::getShortName()
+{
+    return string(data, 11);
+}
+
+FatDate FatEntry::getCreationDate()
+{
+    return FatDate(&data[FAT_CREATION_DATE]);
+}
+
+FatDate FatEntry::getChangeDate()
+{
+    return FatDate(&data[FAT_CHANGE_DATE]);
+}
+
 string FatEntry::getFilename()
 {
     if (longName != "") {
         return longName;
     } else {
         string name;
-        string ext = trim(shortName.substr(8,3));
-        string base = trim(shortName.substr(0,8));
+        string ext = trim(string(data+8, 3));
+        string base = trim(string(data, 8));
 
         if (isErased()) {
             base = base.substr(1);
@@ -65,12 +88,12 @@ bool FatEntry::isHidden()
 
 bool FatEntry::isErased()
 {
-    return ((shortName[0]&0xff) == FAT_ERASED);
+    return ((data[0]&0xff) == FAT_ERASED);
 }
 
 bool FatEntry::isZero()
 {
-    for (int i=0; i<data.size(); i++) {
+    for (int i=0; i<FAT_ENTRY_SIZE; i++) {
         if (data[i] != 0) {
             return false;
         }
@@ -15,6 +15,8 @@ using namespace std;
 #define FAT_CLUSTER_LOW         0x1a
 #define FAT_CLUSTER_HIGH        0x14
 #define FAT_FILESIZE            0x1c
+#define FAT_CREATION_DATE       0x10
+#define FAT_CHANGE_DATE         0x16
 
 // Attributes
 #define FAT_ATTRIBUTES_HIDE     (1<<1)
@@ -25,31 +27,44 @@ using namespace std;
 // Prefix used for erased files
 #define FAT_ERASED                  0xe5
 
+/**
+ * A directory entry, keeping a copy of its raw slot; the short name and
+ * the dates are decoded from it when asked for, so that an entry
+ * without long name does not allocate anything
+ */
 class FatEntry
 {
     public:
         FatEntry();
 
         string getFilename();
+        string getShortName();
         bool isDirectory();
         bool isHidden();
         bool isErased();
 
-        string shortName;
+        FatDate getCreationDate();
+        FatDate getChangeDate();
+
         string longName;
         char attributes;
         unsigned int cluster;
         unsigned long long size;
 
-        FatDate creationDate;
-        FatDate changeDate;
+        /**
+         * Copies a raw slot and decodes its fields
+         */
+        void setData(const char *buffer);
 
+        /**
+         * Writes the fields back to the raw slot
+         */
         void updateData();
-        void setData(string data);
+
         long long sector;
 	long offset;
         bool hasData;
-        string data;
+        char data[FAT_ENTRY_SIZE];
 
         bool isCorrect();
         bool isZero();
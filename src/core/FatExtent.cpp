@@ -0,0 +1,7 @@
+#include "FatExtent.h"
+
+FatExtent::FatExtent(unsigned int start_, unsigned int length_)
+    : start(start_),
+    length(length_)
+{
+}
@@ -0,0 +1,16 @@
+#ifndef _FATCAT_FATEXTENT_H
+#define _FATCAT_FATEXTENT_H
+
+/**
+ * A run of clusters that follow each other in a chain
+ */
+class FatExtent
+{
+    public:
+        FatExtent(unsigned int start = 0, unsigned int length = 0);
+
+        unsigned int start;
+        unsigned int length;
+};
+
+#endif // _FATCAT_FATEXTENT_H
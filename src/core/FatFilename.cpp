@@ -1,52 +1,160 @@
 #include <string>
 #include <iostream>
+#include <FatUtils.h>
 #include "FatFilename.h"
 #include "FatEntry.h"
 
 using namespace std;
 
 #define FAT_LONG_NAME_LAST      0x40
+#define FAT_LONG_NAME_SEQUENCE  0x1f
+#define FAT_LONG_NAME_CHECKSUM  0x0d
 
-// Offset of letters position in a special "long file name" entry
-static unsigned char longFilePos[] = {
-    30, 28, 24, 22, 20, 18, 16, 14, 9, 7, 5, 3, 1
+// Letters of a "long file name" entry, as runs of UTF-16 letters
+#define FAT_LONG_NAME_RUNS      3
+static unsigned char longFileRuns[FAT_LONG_NAME_RUNS][2] = {
+    {1, 5}, {14, 6}, {28, 2}
 };
 
-string FatFilename::getFilename()
+FatFilename::FatFilename()
 {
-    string rfilename;
-    vector<string>::iterator it;
+    clear();
+}
+
+void FatFilename::clear()
+{
+    parts = 0;
+    count = 0;
+    sum = 0;
+    erased = false;
+}
 
-    for (it=letters.begin(); it!=letters.end(); it++) {
-        rfilename += *it;
+unsigned char FatFilename::checksum(const char *entry)
+{
+    unsigned char result = 0;
+
+    for (int i=0; i<11; i++) {
+        result = ((result&1)<<7) + (result>>1) + (unsigned char)entry[i];
     }
-    letters.clear();
 
-    return string(rfilename.rbegin(), rfilename.rend());
+    return result;
 }
 
-void FatFilename::append(char *buffer)
+void FatFilename::append(const char *buffer)
 {
-    if (buffer[FAT_ATTRIBUTES] != 0xf) {
+    if (buffer[FAT_ATTRIBUTES] != FAT_ATTRIBUTES_LONGFILE) {
         return;
     }
 
-    if (buffer[0]&FAT_LONG_NAME_LAST && (buffer[0]&0xff)!=FAT_ERASED) {
-        letters.clear();
+    unsigned char order = buffer[0];
+    unsigned char partSum = buffer[FAT_LONG_NAME_CHECKSUM];
+    unsigned int index;
+
+    if (order == FAT_ERASED) {
+        // Starting again if this part belongs to an other name
+        if (!erased || partSum != sum || count == FAT_LONG_NAME_PARTS) {
+            clear();
+            erased = true;
+            sum = partSum;
+        }
+        count++;
+        index = FAT_LONG_NAME_PARTS-count;
+    } else {
+        unsigned int sequence = order&FAT_LONG_NAME_SEQUENCE;
+        if (sequence == 0 || sequence > FAT_LONG_NAME_PARTS) {
+            clear();
+            return;
+        }
+        index = sequence-1;
+
+        if (erased || (parts && partSum != sum) || (parts&(1<<index))) {
+            clear();
+        }
+        sum = partSum;
+        parts |= 1<<index;
+
+        if (order&FAT_LONG_NAME_LAST) {
+            count = sequence;
+        }
     }
 
-    int i;
-    for (i=0; i<sizeof(longFilePos); i++) {
-        unsigned char c = buffer[longFilePos[i]];
-        unsigned char d = buffer[longFilePos[i]+1];
-        if (c != 0 && c != 0xff) {
-            string letter;
-            if (d != 0x00) {
-                letter += d;
-            }
-            letter += c;
-            letters.push_back(letter);
+    uint16_t *part = &letters[index*FAT_LONG_NAME_LETTERS];
+    for (int run=0; run<FAT_LONG_NAME_RUNS; run++) {
+        const char *letter = &buffer[longFileRuns[run][0]];
+        for (int i=0; i<longFileRuns[run][1]; i++) {
+            *(part++) = FAT_READ_SHORT(letter, 2*i);
         }
     }
 }
 
+string FatFilename::getFilename(const char *entry)
+{
+    string filename;
+    unsigned int start = 0;
+    bool valid;
+
+    if (erased) {
+        // The checksum can't be checked, the first letter of the entry
+        // is lost
+        start = FAT_LONG_NAME_PARTS-count;
+        valid = ((unsigned char)entry[0]) == FAT_ERASED;
+    } else {
+        valid = count && parts == (1u<<count)-1 && sum == checksum(entry);
+    }
+
+    if (!valid || !count) {
+        clear();
+        return filename;
+    }
+
+    // The name ends with a zero letter, unless it fills the last part;
+    // the ASCII letters are copied while looking for the end
+    const uint16_t *name = &letters[start*FAT_LONG_NAME_LETTERS];
+    unsigned int size = count*FAT_LONG_NAME_LETTERS;
+    unsigned int length;
+    uint16_t wide = 0;
+    char ascii[FAT_LONG_NAME_MAX];
+    for (length=0; length<size && name[length] != 0 && name[length] != 0xffff; length++) {
+        wide |= name[length];
+        ascii[length] = name[length];
+    }
+
+    if (wide < 0x80) {
+        filename.assign(ascii, length);
+    } else {
+        filename.reserve(length*3);
+        for (unsigned int i=0; i<length; i++) {
+            unsigned int c = name[i];
+
+            // Surrogate pairs, a lone one is replaced
+            if (c >= 0xd800 && c < 0xe000) {
+                if (c < 0xdc00 && i+1 < length && name[i+1] >= 0xdc00 && name[i+1] < 0xe000) {
+                    c = 0x10000+((c-0xd800)<<10)+(name[i+1]-0xdc00);
+                    i++;
+                } else {
+                    c = 0xfffd;
+                }
+            }
+
+            if (c < 0x80) {
+                filename += (char)c;
+            } else if (c < 0x800) {
+                filename += (char)(0xc0|(c>>6));
+                filename += (char)(0x80|(c&0x3f));
+            } else if (c < 0x10000) {
+                filename += (char)(0xe0|(c>>12));
+                filename += (char)(0x80|((c>>6)&0x3f));
+                filename += (char)(0x80|(c&0x3f));
+            } else {
+                filename += (char)(0xf0|(c>>18));
+                filename += (char)(0x80|((c>>12)&0x3f));
+                filename += (char)(0x80|((c>>6)&0x3f));
+                filename += (char)(0x80|(c&0x3f));
+            }
+        }
+    }
+
+    clear();
+
+    return filename;
+}
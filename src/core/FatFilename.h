@@ -1,24 +1,64 @@
 #ifndef _FATCAT_FILENAME_H
 #define _FATCAT_FILENAME_H
 
-#include <vector>
+#include <stdint.h>
 #include <string>
 
 using namespace std;
 
+// A long name is made of at most 20 parts of 13 UTF-16 letters
+#define FAT_LONG_NAME_PARTS     20
+#define FAT_LONG_NAME_LETTERS   13
+#define FAT_LONG_NAME_MAX       (FAT_LONG_NAME_PARTS*FAT_LONG_NAME_LETTERS)
+
 /**
  * Special class to handle long file names
+ *
+ * The parts are gathered in a fixed UTF-16 buffer at the place given by
+ * their sequence number, so that they can be met in any order; the name
+ * is only used if all its parts were found and if their checksum matches
+ * the short entry
  */
 class FatFilename
 {
     public:
-        string getFilename();
+        FatFilename();
+
+        /**
+         * Adds a long name part
+         */
+        void append(const char *buffer);
+
+        /**
+         * The gathered name, as UTF-8, if it belongs to the given short
+         * entry, else an empty string; the parts are then dropped
+         */
+        string getFilename(const char *entry);
+
+        /**
+         * Drops the gathered parts
+         */
+        void clear();
 
-        void append(char *buffer);
+        /**
+         * Checksum of a short name, kept in its long name parts
+         */
+        static unsigned char checksum(const char *entry);
 
     protected:
-        string data;
-        vector<string> letters;
+        uint16_t letters[FAT_LONG_NAME_MAX];
+
+        // Parts found, one bit per sequence number
+        uint32_t parts;
+
+        // Number of parts, known from the last one
+        unsigned int count;
+        unsigned char sum;
+
+        // The erased parts lost their sequence number, they are kept from
+        // the end of the buffer in the order met, which is the reverse
+        // one of the name
+        bool erased;
 };
 
 #endif // _FATCAT_FILENAME_H
@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "FatSystem.h"
+#include "FatTable.h"
+#include "FatIndex.h"
+
+using namespace std;
+
+// Sections are aligned so that their records can be used in place
+#define FAT_INDEX_ALIGN(x)  (((x)+7)&~7ULL)
+
+static const size_t recordSizes[FAT_INDEX_SECTIONS] = {
+    sizeof(uint32_t),
+    sizeof(FatIndexDirectory),
+    sizeof(FatIndexEntry),
+    sizeof(FatIndexOwner),
+    sizeof(FatIndexExtent),
+    sizeof(char)
+};
+
+static bool compareDirectories(const FatIndexDirectory &a, const FatIndexDirectory &b)
+{
+    return a.cluster < b.cluster;
+}
+
+static bool sameDirectories(const FatIndexDirectory &a, const FatIndexDirectory &b)
+{
+    return a.cluster == b.cluster;
+}
+
+FatIndex::FatIndex()
+    : mapping(NULL),
+    mappingSize(0),
+    header(NULL),
+    isRecording(false)
+{
+}
+
+FatIndex::~FatIndex()
+{
+    close();
+}
+
+uint64_t FatIndex::checksum(const char *data, unsigned long long size, uint64_t hash)
+{
+    unsigned long long i = 0;
+
+    // FNV-1a, on 64-bit words
+    for (; i+8<=size; i+=8) {
+        uint64_t word;
+        memcpy(&word, data+i, sizeof(word));
+        hash = (hash^word)*0x100000001b3ULL;
+    }
+    for (; i<size; i++) {
+        hash = (hash^(unsigned char)data[i])*0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+bool FatIndex::describe(FatSystem &system, FatIndexHeader &description)
+{
+    struct stat info;
+    if (stat(system.filename.c_str(), &info) != 0) {
+        return false;
+    }
+
+    memset(&description, 0, sizeof(description));
+    memcpy(description.magic, FAT_INDEX_MAGIC, sizeof(description.magic));
+    description.version = FAT_INDEX_VERSION;
+    description.bits = system.bits;
+    description.imageSize = info.st_size;
+#ifdef WIN32
+    description.imageTime = info.st_mtime;
+#else
+    // In nanoseconds, the image can be written twice in a second
+    description.imageTime = info.st_mtim.tv_sec*1000000000ULL + info.st_mtim.tv_nsec;
+#endif
+    description.globalOffset = system.globalOffset;
+    description.totalClusters = system.totalClusters;
+    description.fats = system.fats;
+
+    vector<char> buffer;
+    const char *data = system.readData(0, 1, buffer);
+    description.bootChecksum = checksum(data, system.bytesPerSector, 0xcbf29ce484222325ULL);
+
+    for (unsigned int fat=0; fat<system.fats && fat<FAT_INDEX_MAX_FATS; fat++) {
+        unsigned long long start = system.fatStart + system.sectorsPerFat*fat;
+        uint64_t hash = 0xcbf29ce484222325ULL;
+
+        for (unsigned long long sector=0; sector<system.sectorsPerFat; sector+=FAT_TABLE_CHUNK) {
+            unsigned long long toRead = FAT_TABLE_CHUNK;
+            if (sector+toRead > system.sectorsPerFat) {
+                toRead = system.sectorsPerFat-sector;
+            }
+
+            data = system.readData(start+sector, toRead, buffer);
+            hash = checksum(data, toRead*system.bytesPerSector, hash);
+        }
+        description.fatChecksums[fat] = hash;
+    }
+
+    return true;
+}
+
+bool FatIndex::open(FatSystem &system, string filename_)
+{
+    if (!map(filename_)) {
+        return false;
+    }
+
+    // Cheap checks first, the FATs are read last
+    FatIndexHeader description;
+    bool valid = describe(system, description)
+        && header->imageSize == description.imageSize
+        && header->imageTime == description.imageTime
+        && header->globalOffset == description.globalOffset
+        && header->bits == description.bits
+        && header->totalClusters == description.totalClusters
+        && header->fats == description.fats
+        && header->bootChecksum == description.bootChecksum
+        && memcmp(header->fatChecksums, description.fatChecksums, sizeof(description.fatChecksums)) == 0
+        && header->sections[FAT_INDEX_TABLE].count == header->totalClusters;
+
+    if (!valid) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool FatIndex::map(string filename_)
+{
+    close();
+
+#ifndef WIN32
+    int fd = ::open(filename_.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (unsigned long long)info.st_size < sizeof(FatIndexHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    mapping = (const char *)base;
+    mappingSize = info.st_size;
+    header = (const FatIndexHeader *)mapping;
+
+    bool valid = memcmp(header->magic, FAT_INDEX_MAGIC, sizeof(header->magic)) == 0
+        && header->version == FAT_INDEX_VERSION;
+
+    for (int i=0; valid && i<FAT_INDEX_SECTIONS; i++) {
+        const FatIndexSection &section = header->sections[i];
+        valid = section.offset <= mappingSize
+            && section.count <= (mappingSize-section.offset)/recordSizes[i];
+    }
+
+    if (!valid) {
+        close();
+        return false;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void FatIndex::close()
+{
+#ifndef WIN32
+    if (mapping != NULL) {
+        munmap((void *)mapping, mappingSize);
+    }
+#endif
+    mapping = NULL;
+    mappingSize = 0;
+    header = NULL;
+}
+
+bool FatIndex::enabled()
+{
+    return header != NULL;
+}
+
+void FatIndex::record()
+{
+    lock_guard<mutex> lock(recordLock);
+
+    isRecording = true;
+    directories.clear();
+    entries.clear();
+    owners.clear();
+    extents.clear();
+    strings.clear();
+}
+
+bool FatIndex::recording()
+{
+    return isRecording;
+}
+
+uint64_t FatIndex::addString(const string &value)
+{
+    uint64_t offset = strings.size();
+    strings += value;
+
+    return offset;
+}
+
+string FatIndex::getString(uint64_t offset, uint32_t size)
+{
+    const FatIndexSection &strings = header->sections[FAT_INDEX_STRINGS];
+
+    if (offset > strings.count || size > strings.count-offset) {
+        return "";
+    }
+
+    return string(mapping+strings.offset+offset, size);
+}
+
+void FatIndex::packEntry(FatEntry &entry, FatIndexEntry &packed)
+{
+    memset(&packed, 0, sizeof(packed));
+
+    memcpy(packed.data, entry.data, sizeof(packed.data));
+    packed.hasData = entry.hasData;
+    packed.attributes = entry.attributes;
+    packed.cluster = entry.cluster;
+    packed.size = entry.size;
+    packed.sector = entry.sector;
+    packed.offset = entry.offset;
+    packed.longName = addString(entry.longName);
+    packed.longNameSize = entry.longName.size();
+}
+
+void FatIndex::unpackEntry(const FatIndexEntry &packed, FatEntry &entry)
+{
+    memcpy(entry.data, packed.data, sizeof(entry.data));
+    entry.hasData = packed.hasData;
+    entry.longName = getString(packed.longName, packed.longNameSize);
+    entry.attributes = packed.attributes;
+    entry.cluster = packed.cluster;
+    entry.size = packed.size;
+    entry.sector = packed.sector;
+    entry.offset = packed.offset;
+}
+
+void FatIndex::addDirectory(unsigned int cluster, vector<FatEntry> &listing, int clusters, bool hasFree)
+{
+    lock_guard<mutex> lock(recordLock);
+
+    FatIndexDirectory directory;
+    directory.cluster = cluster;
+    directory.clusters = clusters;
+    directory.hasFree = hasFree;
+    directory.count = listing.size();
+    directory.first = entries.size();
+    directories.push_back(directory);
+
+    entries.resize(entries.size()+listing.size());
+    for (unsigned int i=0; i<listing.size(); i++) {
+        packEntry(listing[i], entries[directory.first+i]);
+    }
+}
+
+int FatIndex::addOwner(FatEntry &entry, string path, string parentName, unsigned int parentCluster)
+{
+    lock_guard<mutex> lock(recordLock);
+
+    owners.push_back(FatIndexOwner());
+    FatIndexOwner &owner = owners.back();
+    packEntry(entry, owner.entry);
+    owner.path = addString(path);
+    owner.pathSize = path.size();
+    owner.parentName = addString(parentName);
+    owner.parentNameSize = parentName.size();
+    owner.parentCluster = parentCluster;
+    owner.reserved = 0;
+
+    return owners.size()-1;
+}
+
+void FatIndex::addExtent(unsigned int start, unsigned int length, int owner)
+{
+    lock_guard<mutex> lock(recordLock);
+
+    FatIndexExtent extent;
+    extent.start = start;
+    extent.length = length;
+    extent.owner = owner;
+    extents.push_back(extent);
+}
+
+void FatIndex::save(FatSystem &system, string filename_)
+{
+    lock_guard<mutex> lock(recordLock);
+    FatIndexHeader description;
+
+    if (!describe(system, description)) {
+        ostringstream oss;
+        oss << "Unable to index the image " << system.filename;
+        throw oss.str();
+    }
+
+    FatTable table;
+    if (!system.cacheEnabled) {
+        table.load(system);
+    }
+    vector<uint32_t> &fat = system.cacheEnabled ? system.cache.entries : table.entries;
+
+    // Directories are looked up by cluster, the first listing is kept
+    stable_sort(directories.begin(), directories.end(), compareDirectories);
+    vector<FatIndexDirectory>::iterator last;
+    last = unique(directories.begin(), directories.end(), sameDirectories);
+    directories.erase(last, directories.end());
+
+    const void *data[FAT_INDEX_SECTIONS] = {
+        fat.empty() ? NULL : &fat[0],
+        directories.empty() ? NULL : &directories[0],
+        entries.empty() ? NULL : &entries[0],
+        owners.empty() ? NULL : &owners[0],
+        extents.empty() ? NULL : &extents[0],
+        strings.c_str()
+    };
+    unsigned long long counts[FAT_INDEX_SECTIONS] = {
+        fat.size(), directories.size(), entries.size(),
+        owners.size(), extents.size(), strings.size()
+    };
+
+    unsigned long long offset = FAT_INDEX_ALIGN(sizeof(description));
+    for (int i=0; i<FAT_INDEX_SECTIONS; i++) {
+        description.sections[i].offset = offset;
+        description.sections[i].count = counts[i];
+        offset = FAT_INDEX_ALIGN(offset+counts[i]*recordSizes[i]);
+    }
+
+    // Written aside, so that a failure does not leave a broken index
+    string temporary = filename_ + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (file == NULL) {
+        ostringstream oss;
+        oss << "Unable to open file " << temporary << " for writing";
+        throw oss.str();
+    }
+
+    static const char padding[8] = {0};
+    bool ok = fwrite(&description, sizeof(description), 1, file) == 1;
+    unsigned long long written = sizeof(description);
+    for (int i=0; ok && i<FAT_INDEX_SECTIONS; i++) {
+        ok = fwrite(padding, 1, description.sections[i].offset-written, file) == description.sections[i].offset-written;
+        written = description.sections[i].offset;
+
+        if (ok && counts[i]) {
+            ok = fwrite(data[i], recordSizes[i], counts[i], file) == counts[i];
+            written += counts[i]*recordSizes[i];
+        }
+    }
+
+    if (fclose(file) != 0 || !ok || rename(temporary.c_str(), filename_.c_str()) != 0) {
+        unlink(temporary.c_str());
+        ostringstream oss;
+        oss << "Unable to write the index file " << filename_;
+        throw oss.str();
+    }
+
+    isRecording = false;
+    map(filename_);
+    vector<FatIndexDirectory>().swap(directories);
+    vector<FatIndexEntry>().swap(entries);
+    vector<FatIndexOwner>().swap(owners);
+    vector<FatIndexExtent>().swap(extents);
+    string().swap(strings);
+}
+
+const void *FatIndex::section(int index)
+{
+    return mapping+header->sections[index].offset;
+}
+
+bool FatIndex::getEntries(unsigned int cluster, vector<FatEntry> &listing, int *clusters, bool *hasFree)
+{
+    if (!enabled()) {
+        return false;
+    }
+
+    const FatIndexDirectory *first = (const FatIndexDirectory *)section(FAT_INDEX_DIRECTORIES);
+    const FatIndexDirectory *end = first+header->sections[FAT_INDEX_DIRECTORIES].count;
+    FatIndexDirectory key;
+    key.cluster = cluster;
+
+    const FatIndexDirectory *directory = lower_bound(first, end, key, compareDirectories);
+    if (directory == end || directory->cluster != cluster
+            || directory->first > header->sections[FAT_INDEX_ENTRIES].count
+            || directory->count > header->sections[FAT_INDEX_ENTRIES].count-directory->first) {
+        return false;
+    }
+
+    const FatIndexEntry *packed = (const FatIndexEntry *)section(FAT_INDEX_ENTRIES) + directory->first;
+    listing.resize(directory->count);
+    for (unsigned int i=0; i<directory->count; i++) {
+        unpackEntry(packed[i], listing[i]);
+    }
+
+    if (clusters != NULL) {
+        *clusters = directory->clusters;
+    }
+    if (hasFree != NULL) {
+        *hasFree = directory->hasFree;
+    }
+
+    return true;
+}
+
+bool FatIndex::loadTable(FatTable &table)
+{
+    if (!enabled()) {
+        return false;
+    }
+
+    table.assign((const uint32_t *)section(FAT_INDEX_TABLE), header->sections[FAT_INDEX_TABLE].count);
+
+    return true;
+}
+
+unsigned int FatIndex::ownersCount()
+{
+    return enabled() ? header->sections[FAT_INDEX_OWNERS].count : 0;
+}
+
+void FatIndex::getOwner(unsigned int index, FatEntry &entry, string &path, string &parentName, unsigned int &parentCluster)
+{
+    const FatIndexOwner &owner = ((const FatIndexOwner *)section(FAT_INDEX_OWNERS))[index];
+
+    unpackEntry(owner.entry, entry);
+    path = getString(owner.path, owner.pathSize);
+    parentName = getString(owner.parentName, owner.parentNameSize);
+    parentCluster = owner.parentCluster;
+}
+
+unsigned int FatIndex::extentsCount()
+{
+    return enabled() ? header->sections[FAT_INDEX_EXTENTS].count : 0;
+}
+
+const FatIndexExtent *FatIndex::getExtents()
+{
+    return (const FatIndexExtent *)section(FAT_INDEX_EXTENTS);
+}
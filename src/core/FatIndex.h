@@ -0,0 +1,188 @@
+#ifndef _FATCAT_FATINDEX_H
+#define _FATCAT_FATINDEX_H
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "FatEntry.h"
+
+using namespace std;
+
+#define FAT_INDEX_MAGIC         "FATIDX\r\n"
+#define FAT_INDEX_VERSION       2
+
+// Number of FATs whose checksums are kept
+#define FAT_INDEX_MAX_FATS      4
+
+// Sections of the file
+#define FAT_INDEX_TABLE         0
+#define FAT_INDEX_DIRECTORIES   1
+#define FAT_INDEX_ENTRIES       2
+#define FAT_INDEX_OWNERS        3
+#define FAT_INDEX_EXTENTS       4
+#define FAT_INDEX_STRINGS       5
+#define FAT_INDEX_SECTIONS      6
+
+class FatSystem;
+class FatTable;
+
+struct FatIndexSection
+{
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct FatIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bits;
+    uint64_t imageSize;
+    uint64_t imageTime;
+    uint64_t globalOffset;
+    uint64_t bootChecksum;
+    uint64_t fatChecksums[FAT_INDEX_MAX_FATS];
+    uint32_t totalClusters;
+    uint32_t fats;
+    FatIndexSection sections[FAT_INDEX_SECTIONS];
+};
+
+struct FatIndexEntry
+{
+    char data[FAT_ENTRY_SIZE];
+    char attributes;
+    uint8_t hasData;
+    uint16_t reserved;
+    uint32_t cluster;
+    uint64_t size;
+    int64_t sector;
+    int64_t offset;
+    uint64_t longName;
+    uint32_t longNameSize;
+    uint32_t reserved2;
+};
+
+struct FatIndexDirectory
+{
+    uint32_t cluster;
+    uint32_t clusters;
+    uint32_t hasFree;
+    uint32_t count;
+    uint64_t first;
+};
+
+struct FatIndexOwner
+{
+    FatIndexEntry entry;
+    uint64_t path;
+    uint64_t parentName;
+    uint32_t pathSize;
+    uint32_t parentNameSize;
+    uint32_t parentCluster;
+    uint32_t reserved;
+};
+
+struct FatIndexExtent
+{
+    uint32_t start;
+    uint32_t length;
+    uint32_t owner;
+};
+
+/**
+ * A sidecar file keeping the decoded FAT, the directories listings and
+ * the owners of the clusters of an image, so that they don't have to be
+ * read again by later runs
+ *
+ * The file is made of fixed-size records and is mapped in memory; it is
+ * only used if the size, the modification time, the boot sector and the
+ * FATs of the image did not change since it was written
+ */
+class FatIndex
+{
+    public:
+        FatIndex();
+        ~FatIndex();
+
+        /**
+         * Maps an index file, returns false if it is missing or if it
+         * does not match the image
+         */
+        bool open(FatSystem &system, string filename);
+        void close();
+        bool enabled();
+
+        /**
+         * Maps an index file, only checking its own consistency
+         */
+        bool map(string filename);
+
+        /**
+         * Starts keeping the directories read through getEntries()
+         */
+        void record();
+        bool recording();
+
+        /**
+         * Adds the things to write, while recording
+         */
+        void addDirectory(unsigned int cluster, vector<FatEntry> &entries, int clusters, bool hasFree);
+        int addOwner(FatEntry &entry, string path, string parentName, unsigned int parentCluster);
+        void addExtent(unsigned int start, unsigned int length, int owner);
+
+        /**
+         * Writes the recorded things to a file, and maps it
+         */
+        void save(FatSystem &system, string filename);
+
+        /**
+         * Listing of a directory, returns false if it is not indexed
+         */
+        bool getEntries(unsigned int cluster, vector<FatEntry> &entries, int *clusters, bool *hasFree);
+
+        /**
+         * Copies the decoded FAT to a table
+         */
+        bool loadTable(FatTable &table);
+
+        /**
+         * Indexed owners and their extents, sorted by first cluster
+         */
+        unsigned int ownersCount();
+        void getOwner(unsigned int index, FatEntry &entry, string &path, string &parentName, unsigned int &parentCluster);
+        unsigned int extentsCount();
+        const FatIndexExtent *getExtents();
+
+    protected:
+        const char *mapping;
+        size_t mappingSize;
+        const FatIndexHeader *header;
+        bool isRecording;
+
+        // Recorded things, until saved
+        mutex recordLock;
+        vector<FatIndexDirectory> directories;
+        vector<FatIndexEntry> entries;
+        vector<FatIndexOwner> owners;
+        vector<FatIndexExtent> extents;
+        string strings;
+
+        /**
+         * Fills the header fields describing the image
+         */
+        bool describe(FatSystem &system, FatIndexHeader &description);
+
+        /**
+         * Fast 64-bit hash of some data
+         */
+        static uint64_t checksum(const char *data, unsigned long long size, uint64_t hash);
+
+        uint64_t addString(const string &value);
+        string getString(uint64_t offset, uint32_t size);
+        void packEntry(FatEntry &entry, FatIndexEntry &packed);
+        void unpackEntry(const FatIndexEntry &packed, FatEntry &entry);
+        const void *section(int index);
+};
+
+#endif // _FATCAT_FATINDEX_H
@@ -19,7 +19,7 @@ string FatPath::getPath()
 string FatPath::getDirname()
 {
     string dirname = "";
-    for (int i=0; i<parts.size()-1; i++) {
+    for (unsigned int i=0; i<parts.size()-1; i++) {
         dirname += parts[i] + "/";
     }
 
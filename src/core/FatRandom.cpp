@@ -0,0 +1,75 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <string.h>
+#include "FatRandom.h"
+
+using namespace std;
+
+/**
+ * Next splitmix64 value, used to seed the states so that they are never zero
+ */
+static uint64_t splitMix(uint64_t &seed)
+{
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+    z = (z^(z>>27))*0x94d049bb133111ebULL;
+    return z^(z>>31);
+}
+
+FatRandom::FatRandom(uint64_t seed)
+{
+    for (int i=0; i<FAT_RANDOM_LANES; i++) {
+        low[i] = splitMix(seed);
+    }
+    for (int i=0; i<FAT_RANDOM_LANES; i++) {
+        high[i] = splitMix(seed);
+    }
+}
+
+void FatRandom::next(uint64_t *output)
+{
+    for (int i=0; i<FAT_RANDOM_LANES; i++) {
+        uint64_t x = low[i];
+        uint64_t y = high[i];
+        low[i] = y;
+        x ^= x<<23;
+        high[i] = x^y^(x>>17)^(y>>26);
+        output[i] = high[i]+y;
+    }
+}
+
+void FatRandom::fill(char *buffer, size_t size)
+{
+    const size_t step = FAT_RANDOM_LANES*sizeof(uint64_t);
+    size_t i = 0;
+
+#ifdef __SSE2__
+    __m128i x0 = _mm_loadu_si128((const __m128i *)&low[0]);
+    __m128i x1 = _mm_loadu_si128((const __m128i *)&low[2]);
+    __m128i y0 = _mm_loadu_si128((const __m128i *)&high[0]);
+    __m128i y1 = _mm_loadu_si128((const __m128i *)&high[2]);
+
+    for (; i+step<=size; i+=step) {
+        __m128i s0 = _mm_xor_si128(x0, _mm_slli_epi64(x0, 23));
+        __m128i s1 = _mm_xor_si128(x1, _mm_slli_epi64(x1, 23));
+        x0 = y0;
+        x1 = y1;
+        y0 = _mm_xor_si128(_mm_xor_si128(s0, y0), _mm_xor_si128(_mm_srli_epi64(s0, 17), _mm_srli_epi64(y0, 26)));
+        y1 = _mm_xor_si128(_mm_xor_si128(s1, y1), _mm_xor_si128(_mm_srli_epi64(s1, 17), _mm_srli_epi64(y1, 26)));
+        _mm_storeu_si128((__m128i *)(buffer+i), _mm_add_epi64(y0, x0));
+        _mm_storeu_si128((__m128i *)(buffer+i+16), _mm_add_epi64(y1, x1));
+    }
+
+    _mm_storeu_si128((__m128i *)&low[0], x0);
+    _mm_storeu_si128((__m128i *)&low[2], x1);
+    _mm_storeu_si128((__m128i *)&high[0], y0);
+    _mm_storeu_si128((__m128i *)&high[2], y1);
+#endif
+
+    uint64_t values[FAT_RANDOM_LANES];
+    for (; i<size; i+=step) {
+        next(values);
+        memcpy(buffer+i, values, size-i < step ? size-i : step);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef _FATCAT_FATRANDOM_H
+#define _FATCAT_FATRANDOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+using namespace std;
+
+// Number of generators run side by side
+#define FAT_RANDOM_LANES    4
+
+/**
+ * Fast pseudo-random bytes, used to scramble the unallocated clusters
+ *
+ * Four xorshift128+ generators are run side by side, two per SSE2
+ * register; this is not suitable for cryptography
+ */
+class FatRandom
+{
+    public:
+        FatRandom(uint64_t seed);
+
+        /**
+         * Fills a buffer with random bytes
+         */
+        void fill(char *buffer, size_t size);
+
+    protected:
+        // The two words of the state of each generator
+        uint64_t low[FAT_RANDOM_LANES];
+        uint64_t high[FAT_RANDOM_LANES];
+
+        /**
+         * Next value of each generator, scalar version
+         */
+        void next(uint64_t *output);
+};
+
+#endif // _FATCAT_FATRANDOM_H
@@ -0,0 +1,100 @@
+#include <ctype.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "FatEntry.h"
+#include "FatSlots.h"
+
+using namespace std;
+
+// Name bytes looked at for printable characters, 1 to 10
+#define FAT_SLOTS_NAME_MASK     0x7fe
+
+void FatSlots::clear()
+{
+    memset(zero, 0, sizeof(zero));
+    memset(longName, 0, sizeof(longName));
+    memset(entry, 0, sizeof(entry));
+    memset(erased, 0, sizeof(erased));
+}
+
+void FatSlots::classifySlot(const char *slot, unsigned int index, bool isZero, bool printable)
+{
+    unsigned char attributes = slot[FAT_ATTRIBUTES];
+    unsigned int word = index/64;
+    uint64_t bit = 1ULL<<(index%64);
+
+    // Without branches, the kinds of the slots of damaged areas can't
+    // be predicted
+    uint64_t isLong = -(uint64_t)(attributes == FAT_ATTRIBUTES_LONGFILE);
+    uint64_t isEmpty = -(uint64_t)isZero & ~isLong;
+    uint64_t isShort = ~(isLong|isEmpty);
+    uint64_t isCorrect = -(uint64_t)(printable & ((attributes == 0) | ((attributes&(FAT_ATTRIBUTES_DIR|FAT_ATTRIBUTES_FILE)) != 0)));
+    uint64_t isErased = -(uint64_t)((slot[0]&0xff) == FAT_ERASED);
+
+    longName[word] |= bit&isLong;
+    zero[word] |= bit&isEmpty;
+    entry[word] |= bit&isShort&isCorrect;
+    erased[word] |= bit&isShort&isErased;
+}
+
+void FatSlots::classify(const char *data, unsigned int count)
+{
+#if defined(__AVX2__) || defined(__SSE2__)
+    clear();
+
+    // Printable characters are 0x20 to 0x7e, the bytes from 0x80 are
+    // negative when compared as signed
+#ifdef __AVX2__
+    const __m256i low = _mm256_set1_epi8(0x1f);
+    const __m256i high = _mm256_set1_epi8(0x7f);
+#else
+    const __m128i low = _mm_set1_epi8(0x1f);
+    const __m128i high = _mm_set1_epi8(0x7f);
+    const __m128i nothing = _mm_setzero_si128();
+#endif
+
+    for (unsigned int i=0; i<count; i++) {
+        const char *slot = data+i*FAT_ENTRY_SIZE;
+#ifdef __AVX2__
+        __m256i v = _mm256_loadu_si256((const __m256i *)slot);
+        bool isZero = _mm256_testz_si256(v, v);
+        __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(v, low), _mm256_cmpgt_epi8(high, v));
+        unsigned int name = _mm256_movemask_epi8(printable);
+#else
+        __m128i first = _mm_loadu_si128((const __m128i *)slot);
+        __m128i second = _mm_loadu_si128((const __m128i *)(slot+16));
+        bool isZero = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(first, second), nothing)) == 0xffff;
+        __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(first, low), _mm_cmplt_epi8(first, high));
+        unsigned int name = _mm_movemask_epi8(printable);
+#endif
+        classifySlot(slot, i, isZero, (name&FAT_SLOTS_NAME_MASK) != 0);
+    }
+#else
+    classifyScalar(data, count);
+#endif
+}
+
+void FatSlots::classifyScalar(const char *data, unsigned int count)
+{
+    clear();
+
+    for (unsigned int i=0; i<count; i++) {
+        const char *slot = data+i*FAT_ENTRY_SIZE;
+        bool isZero = true;
+        bool printable = false;
+
+        for (int k=0; k<FAT_ENTRY_SIZE && isZero; k++) {
+            isZero = (slot[k] == 0);
+        }
+        for (int k=1; k<11 && !printable; k++) {
+            printable = isprint((unsigned char)slot[k]);
+        }
+
+        classifySlot(slot, i, isZero, printable);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef _FATCAT_FATSLOTS_H
+#define _FATCAT_FATSLOTS_H
+
+#include <stdint.h>
+
+using namespace std;
+
+// Maximum number of slots classified at once, a 4096 bytes sector
+#define FAT_SLOTS_MAX       128
+#define FAT_SLOTS_WORDS     (FAT_SLOTS_MAX/64)
+
+/**
+ * Kinds of the 32-byte slots of some directory data, one bit per slot
+ *
+ * A slot is either zero, a long file name part, a short entry that looks
+ * correct (see FatEntry::isCorrect(), the checks needing the decoded
+ * entry are not done) or garbage; erased is set for the short entries
+ * and garbage starting with the erased mark
+ */
+class FatSlots
+{
+    public:
+        uint64_t zero[FAT_SLOTS_WORDS];
+        uint64_t longName[FAT_SLOTS_WORDS];
+        uint64_t entry[FAT_SLOTS_WORDS];
+        uint64_t erased[FAT_SLOTS_WORDS];
+
+        /**
+         * Classifies count slots, at most FAT_SLOTS_MAX
+         */
+        void classify(const char *data, unsigned int count);
+
+        /**
+         * Same, one byte at a time
+         */
+        void classifyScalar(const char *data, unsigned int count);
+
+        static bool has(const uint64_t *mask, unsigned int slot)
+        {
+            return (mask[slot/64]>>(slot%64))&1;
+        }
+
+    protected:
+        void clear();
+
+        /**
+         * Sets the bits of a slot, knowing if it is zero and if one of
+         * its name bytes is printable
+         */
+        void classifySlot(const char *slot, unsigned int index, bool isZero, bool printable);
+};
+
+#endif // _FATCAT_FATSLOTS_H
@@ -2,19 +2,38 @@
 #include <time.h>
 #include <string>
 #include <iostream>
+#include <fstream>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/falloc.h>
+#define FAT_HAVE_SENDFILE
+#define FAT_HAVE_DISCARD
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define FAT_HAVE_COPY_FILE_RANGE
+#endif
+#endif
 #include <set>
+#include <chrono>
 
 #include <FatUtils.h>
 #include "FatFilename.h"
+#include "FatCodec.h"
 #include "FatEntry.h"
 #include "FatDate.h"
 #include "FatSystem.h"
+#include "FatSlots.h"
+#include "FatRandom.h"
 
 using namespace std;
 
@@ -22,20 +41,33 @@ using namespace std;
  * Opens the FAT resource
  */
 FatSystem::FatSystem(string filename_, unsigned long long globalOffset_)
-    : strange(0),
-    filename(filename_),
+    : filename(filename_),
     globalOffset(globalOffset_),
-    totalSize(-1),
+    mapping(NULL),
+    mappingSize(0),
+    type(FAT32),
     totalSectors(-1),
-    listDeleted(false),
+    strange(0),
+    rootEntries(0),
+    fsInfoSector(0),
+    hasFsInfo(false),
+    fsInfoFree(FAT_FSINFO_UNKNOWN),
+    fsInfoNextFree(FAT_FSINFO_UNKNOWN),
+    totalSize(-1),
+    cacheEnabled(false),
     statsComputed(false),
     freeClusters(0),
-    cacheEnabled(false),
-    type(FAT32),
-    rootEntries(0)
+    listDeleted(false),
+    mappingBase(NULL),
+    mappingLength(0),
+    mappingFd(-1),
+    blockCacheCapacity(0),
+    driverReentrant(false)
 {
     dsk_err_t err = dsk_open(&fd, filename.c_str(), NULL, NULL);
     writeMode = false;
+    readNextCluster = &FatSystem::readNextClusterAs<32>;
+    changeNextCluster = &FatSystem::changeNextClusterAs<32>;
 
     if (err != DSK_ERR_OK) {
         ostringstream oss;
@@ -43,6 +75,19 @@ FatSystem::FatSystem(string filename_, unsigned long long globalOffset_)
 
         throw oss.str();
     }
+
+    // The driver sees the image as starting at the offset, the geometry
+    // is then probed from the partition boot sector
+    if (globalOffset != 0) {
+        err = dsk_set_offset(fd, globalOffset);
+        if (err != DSK_ERR_OK) {
+            ostringstream oss;
+            oss << "! Unable to use the offset " << globalOffset << " on the input file: " << filename << " err:" << err;
+
+            throw oss.str();
+        }
+    }
+
     err = dsk_getgeom(fd, &geom);
     if (err != DSK_ERR_OK) {
         ostringstream oss;
@@ -50,61 +95,308 @@ FatSystem::FatSystem(string filename_, unsigned long long globalOffset_)
 
         throw oss.str();
     }
+
+    // The raw driver uses positional reads
+    const char *driver = dsk_drvname(fd);
+    driverReentrant = (driver != NULL && (strcmp(driver, "raw") == 0
+                || strcmp(driver, "rawoo") == 0 || strcmp(driver, "rawob") == 0));
+
+    mapImage();
+}
+
+/**
+ * Plain raw images are mapped so that sectors can be accessed without
+ * going through the driver, other formats use the normal path
+ */
+bool FatSystem::rawImage()
+{
+    const char *driver = dsk_drvname(fd);
+
+    if (driver == NULL || strcmp(driver, "raw") != 0 || dsk_compname(fd) != NULL) {
+        return false;
+    }
+
+    // Logical sectors must follow each other in the file
+    if (geom.dg_sidedness != SIDES_ALT && geom.dg_heads != 1) {
+        return false;
+    }
+
+    return !(geom.dg_fm & RECMODE_COMPLEMENT);
+}
+
+void FatSystem::mapImage()
+{
+#ifndef WIN32
+    if (!rawImage()) {
+        return;
+    }
+
+    int mapFd = open(filename.c_str(), O_RDONLY);
+    if (mapFd < 0) {
+        return;
+    }
+
+    off_t end = lseek(mapFd, 0, SEEK_END);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    unsigned long long start = globalOffset - (globalOffset % pageSize);
+
+    if (end > 0 && (unsigned long long)end > globalOffset
+            && (unsigned long long)end-start == (size_t)(end-start)) {
+        void *base = mmap(NULL, end-start, PROT_READ, MAP_SHARED, mapFd, start);
+
+        if (base != MAP_FAILED) {
+            mappingBase = base;
+            mappingLength = end-start;
+            mapping = (const char *)base + (globalOffset-start);
+            mappingSize = end-globalOffset;
+
+            // Kept to copy files data without going through memory
+            mappingFd = mapFd;
+            return;
+        }
+    }
+
+    close(mapFd);
+#endif
+}
+
+void FatSystem::unmapImage()
+{
+#ifndef WIN32
+    if (mappingBase != NULL) {
+        munmap(mappingBase, mappingLength);
+    }
+    if (mappingFd >= 0) {
+        close(mappingFd);
+    }
+#endif
+    mappingFd = -1;
+    mappingBase = NULL;
+    mappingLength = 0;
+    mapping = NULL;
+    mappingSize = 0;
+
+    blockCache.setCapacity(blockCacheCapacity);
 }
 
 void FatSystem::enableCache()
 {
+    lock_guard<mutex> lock(cacheLock);
+
     if (!cacheEnabled) {
         cout << "Computing FAT cache..." << endl;
-        for (int cluster=0; cluster<totalClusters; cluster++) {
-            cache[cluster] = nextCluster(cluster);
-        }
+        loadCache();
+    }
+}
 
-        cacheEnabled = true;
+void FatSystem::loadCache()
+{
+    if (!index.loadTable(cache)) {
+        cache.load(*this);
     }
+
+    cacheEnabled = true;
+}
+
+FatTable &FatSystem::getTable()
+{
+    enableCache();
+
+    return cache;
+}
+
+bool FatSystem::cacheFits()
+{
+    return cacheEnabled || fatSize <= FAT_EXTENTS_MAX_TABLE || index.enabled();
 }
 
 void FatSystem::enableWrite()
 {
+    // Writes go through the driver, the mapping would not be coherent
+    unmapImage();
+
+    // The index is kept on disk, it is checked against the image when opened
+    index.close();
     writeMode = true;
 }
 
 FatSystem::~FatSystem()
 {
+    if (writeMode) {
+        flush();
+    }
+    unmapImage();
     dsk_close(&fd);
 }
 
+void FatSystem::enableBlockCache(unsigned long long megabytes)
+{
+    blockCacheCapacity = (megabytes*1024*1024)/(FAT_CACHE_BLOCK*geom.dg_secsize);
+
+    // The mapped sectors are not read through the driver
+    if (mapping == NULL) {
+        blockCache.setCapacity(blockCacheCapacity);
+    }
+}
+
 /**
  * Reading some data
  */
 vector<char> FatSystem::readData(unsigned long long address, int size)
 {
-    if (totalSectors != -1 && address+size > totalSectors) {
+    if (totalSectors != (unsigned long long)-1 && address+size > totalSectors) {
         cerr << "! Trying to read outside the disk" << endl;
     }
 
     vector<char> buf(size * geom.dg_secsize);
-    for (int i = 0; i < size; i++)
-    {
-        dsk_err_t err = dsk_lread(fd, &geom, &buf[i * geom.dg_secsize], address + i);
-        if (err != DSK_ERR_OK)
-                cerr << "! Error reading sector " << address << endl;
+    if (size <= 0) {
+        return buf;
     }
 
+    const char *mapped = mappedData(address, size);
+    if (mapped != NULL) {
+        memcpy(&buf[0], mapped, buf.size());
+    } else if (blockCache.enabled() && size <= FAT_CACHE_MAX_READ) {
+        readCached(address, size, &buf[0]);
+    } else {
+        readSectors(address, size, &buf[0]);
+    }
+
+    // FAT sectors may have pending changes
+    writeCache.overlay(address, &buf[0], size);
+
     return buf;
 }
 
+const char *FatSystem::readData(unsigned long long address, int size, vector<char> &buffer)
+{
+    const char *mapped = mappedData(address, size);
+
+    if (mapped != NULL) {
+        if (totalSectors != (unsigned long long)-1 && address+size > totalSectors) {
+            cerr << "! Trying to read outside the disk" << endl;
+        }
+
+        return mapped;
+    }
+
+    buffer = readData(address, size);
+
+    return buffer.empty() ? NULL : &buffer[0];
+}
+
+const char *FatSystem::mappedData(unsigned long long address, int size)
+{
+    unsigned long long start = address*geom.dg_secsize;
+    unsigned long long length = size*geom.dg_secsize;
+
+    if (mapping != NULL && size > 0 && start < mappingSize && length <= mappingSize-start) {
+        return mapping+start;
+    }
+
+    return NULL;
+}
+
+void FatSystem::readSectors(unsigned long long address, int size, char *buffer)
+{
+    unique_lock<mutex> lock(driverLock, defer_lock);
+    if (!driverReentrant) {
+        lock.lock();
+    }
+
+    dsk_err_t err = dsk_lread_multi(fd, &geom, buffer, address, size);
+
+    if (err != DSK_ERR_OK) {
+        // Retrying sector by sector to know which ones are unreadable
+        for (int i = 0; i < size; i++)
+        {
+            err = dsk_lread(fd, &geom, &buffer[i * geom.dg_secsize], address + i);
+            if (err != DSK_ERR_OK)
+                    cerr << "! Error reading sector " << address + i << endl;
+        }
+    }
+}
+
+/**
+ * Reads through the block cache, missing blocks are read as a whole
+ */
+void FatSystem::readCached(unsigned long long address, int size, char *buffer)
+{
+    unsigned long long first = address/FAT_CACHE_BLOCK;
+    unsigned long long last = (address+size-1)/FAT_CACHE_BLOCK;
+    vector<char> data(FAT_CACHE_BLOCK*geom.dg_secsize);
+
+    for (unsigned long long block=first; block<=last; block++) {
+        unsigned long long start = block*FAT_CACHE_BLOCK;
+        unsigned long long from = start > address ? start : address;
+        unsigned long long to = start+FAT_CACHE_BLOCK < address+size ? start+FAT_CACHE_BLOCK : address+size;
+        char *output = buffer+(from-address)*geom.dg_secsize;
+
+        {
+            lock_guard<mutex> lock(blockCacheLock);
+            const vector<char> *cached = blockCache.get(block);
+
+            if (cached != NULL) {
+                memcpy(output, &(*cached)[(from-start)*geom.dg_secsize], (to-from)*geom.dg_secsize);
+                continue;
+            }
+        }
+
+        dsk_err_t err;
+        {
+            unique_lock<mutex> lock(driverLock, defer_lock);
+            if (!driverReentrant) {
+                lock.lock();
+            }
+            err = dsk_lread_multi(fd, &geom, &data[0], start, FAT_CACHE_BLOCK);
+        }
+
+        if (err == DSK_ERR_OK) {
+            lock_guard<mutex> lock(blockCacheLock);
+            blockCache.put(block, data);
+            memcpy(output, &data[(from-start)*geom.dg_secsize], (to-from)*geom.dg_secsize);
+        } else {
+            // Blocks that can't be fully read (end of the disk or
+            // bad sectors) are not cached
+            readSectors(from, to-from, output);
+        }
+    }
+}
+
 int FatSystem::writeData(unsigned long long address, const char *buffer, int size)
 {
     if (!writeMode) {
         throw string("Trying to write data while write mode is disabled");
     }
 
-    for (int i = 0; i < size; i++)
+    if (size <= 0) {
+        return 0;
+    }
+
+    unique_lock<mutex> lock(driverLock, defer_lock);
+    if (!driverReentrant) {
+        lock.lock();
+    }
+
+    dsk_err_t err = dsk_lwrite_multi(fd, &geom, buffer, address, size);
+    {
+        lock_guard<mutex> lock(blockCacheLock);
+        blockCache.update(address, buffer, size, geom.dg_secsize);
+    }
+    writeCache.update(address, buffer, size);
     {
-        dsk_err_t err = dsk_lwrite(fd, &geom, &buffer[i * geom.dg_secsize], address + i);
-        if (err != DSK_ERR_OK)
-                cerr << "! Error writing sector " << address << endl;
+        lock_guard<mutex> lock(directoryCacheLock);
+        directoryCache.clear();
+    }
+
+    if (err != DSK_ERR_OK) {
+        // Retrying sector by sector to know which ones are unwritable
+        for (int i = 0; i < size; i++)
+        {
+            err = dsk_lwrite(fd, &geom, &buffer[i * geom.dg_secsize], address + i);
+            if (err != DSK_ERR_OK)
+                    cerr << "! Error writing sector " << address + i << endl;
+        }
     }
 
     return size;
@@ -128,6 +420,7 @@ void FatSystem::parseHeader()
     if (sectorsPerFat != 0) {
         type = FAT16;
         bits = 16;
+        diskId = FAT_READ_LONG(buffer, FAT16_DISK_ID);
         diskLabel = string(buffer+FAT16_DISK_LABEL, FAT16_DISK_LABEL_SIZE);
         fsType = string(buffer+FAT16_DISK_FS, FAT16_DISK_FS_SIZE);
         rootEntries = FAT_READ_SHORT(buffer, FAT16_ROOT_ENTRIES)&0xffff;
@@ -139,7 +432,7 @@ void FatSystem::parseHeader()
 
         totalSectors = FAT_READ_SHORT(buffer, FAT16_TOTAL_SECTORS)&0xffff;
         if (!totalSectors) {
-            totalSectors = FAT_READ_LONG(buffer, FAT_TOTAL_SECTORS)&0xffffffff;
+            totalSectors = (FAT_READ_LONG(buffer, FAT_TOTAL_SECTORS))&0xffffffff;
         }
         if((totalSectors / sectorsPerCluster) < 0xff4) {
             bits = 12;
@@ -147,11 +440,14 @@ void FatSystem::parseHeader()
     } else {
         type = FAT32;
         bits = 32;
-        sectorsPerFat = FAT_READ_LONG(buffer, FAT_SECTORS_PER_FAT)&0xffffffff;
-        totalSectors = FAT_READ_LONG(buffer, FAT_TOTAL_SECTORS)&0xffffffff;
+        sectorsPerFat = (FAT_READ_LONG(buffer, FAT_SECTORS_PER_FAT))&0xffffffff;
+        totalSectors = (FAT_READ_LONG(buffer, FAT_TOTAL_SECTORS))&0xffffffff;
+        diskId = FAT_READ_LONG(buffer, FAT_DISK_ID);
         diskLabel = string(buffer+FAT_DISK_LABEL, FAT_DISK_LABEL_SIZE);
-        rootDirectory = FAT_READ_LONG(buffer, FAT_ROOT_DIRECTORY)&0xffffffff;
+        rootDirectory = (FAT_READ_LONG(buffer, FAT_ROOT_DIRECTORY))&0xffffffff;
         fsType = string(buffer+FAT_DISK_FS, FAT_DISK_FS_SIZE);
+        fsInfoSector = FAT_READ_SHORT(buffer, FAT_FSINFO_SECTOR)&0xffff;
+        parseFsInfo();
     }
 
     if (!((bytesPerSector == 256) || (bytesPerSector == 512) || (bytesPerSector == 1024))) {
@@ -160,7 +456,7 @@ void FatSystem::parseHeader()
     }
 
     if (bytesPerSector != geom.dg_secsize) {
-        printf("WARNING: Bytes per sector mismatch (%llu) (%llu)\n", bytesPerSector, geom.dg_secsize);
+        printf("WARNING: Bytes per sector mismatch (%llu) (%llu)\n", bytesPerSector, (unsigned long long)geom.dg_secsize);
         strange++;
     }
 
@@ -180,58 +476,64 @@ void FatSystem::parseHeader()
     }
 }
 
+/**
+ * Parses the FAT32 FSInfo sector, which is in the reserved sectors
+ */
+void FatSystem::parseFsInfo()
+{
+    hasFsInfo = false;
+
+    if (fsInfoSector == 0 || fsInfoSector >= reservedSectors) {
+        return;
+    }
+
+    vector<char> sector = readData(fsInfoSector, 1);
+    const char *buffer = &sector[0];
+    if (sector.size() < 512
+        || ((FAT_READ_LONG(buffer, FAT_FSINFO_LEAD))&0xffffffff) != FAT_FSINFO_LEAD_SIGNATURE
+        || ((FAT_READ_LONG(buffer, FAT_FSINFO_STRUCT))&0xffffffff) != FAT_FSINFO_STRUCT_SIGNATURE
+        || ((FAT_READ_LONG(buffer, FAT_FSINFO_TRAIL))&0xffffffff) != FAT_FSINFO_TRAIL_SIGNATURE) {
+        return;
+    }
+
+    hasFsInfo = true;
+    fsInfoFree = (FAT_READ_LONG(buffer, FAT_FSINFO_FREE))&0xffffffff;
+    fsInfoNextFree = (FAT_READ_LONG(buffer, FAT_FSINFO_NEXT_FREE))&0xffffffff;
+}
+
 /**
  * Returns the 32-bit fat value for the given cluster number
  */
 unsigned int FatSystem::nextCluster(unsigned int cluster, int fat)
 {
-    int bytes = (bits == 32 ? 4 : 2);
-
     if (!validCluster(cluster)) {
         return 0;
     }
 
-    if (cacheEnabled) {
-        return cache[cluster];
+    if (cacheEnabled && fat == 0) {
+        return cache.entries[cluster];
     }
 
-    int offset = (float)(cluster * bytes) * (bits == 12 ? 12.0/16.0 : 1.0);
-
-    vector<char> sector = readData(fatStart+((fatSize*fat+offset)/bytesPerSector), bits == 12 ? 2 : 1);
-    char* buffer = &sector[offset%bytesPerSector];
+    return (this->*readNextCluster)(cluster, fat);
+}
 
-    unsigned int next;
+template<int Bits>
+unsigned int FatSystem::readNextClusterAs(unsigned int cluster, int fat)
+{
+    unsigned long long offset = FatCodec<Bits>::offset(cluster);
+    unsigned long long address = fatStart+((fatSize*fat+offset)/bytesPerSector);
+    unsigned int position = offset%bytesPerSector;
 
-    if (type == FAT32) {
-        next = FAT_READ_LONG(buffer, 0)&0x0fffffff;
+    // Only the FAT12 entries can be across two sectors
+    int size = position+FatCodec<Bits>::size > bytesPerSector ? 2 : 1;
 
-        if (next >= 0x0ffffff0) {
-            return FAT_LAST;
-        } else {
-            return next;
-        }
-    } else {
-        next = FAT_READ_SHORT(buffer,0)&0xffff;
-
-        if (bits == 12) {
-            int bit = cluster*bits;
-            if (bit%8 != 0) {
-                next = next >> 4;
-            }
-            next &= 0xfff;
-            if (next >= 0xff0) {
-                return FAT_LAST;
-            } else {
-                return next;
-            }
-        } else {
-            if (next >= 0xfff0) {
-                return FAT_LAST;
-            } else {
-                return next;
-            }
-        }
+    vector<char> sector;
+    const char *data = writeCache.find(address, size);
+    if (data == NULL) {
+        data = readData(address, size, sector);
     }
+
+    return FatCodec<Bits>::decodeValue(FatCodec<Bits>::get(&data[position], cluster));
 }
 
 /**
@@ -239,35 +541,57 @@ unsigned int FatSystem::nextCluster(unsigned int cluster, int fat)
  */
 bool FatSystem::writeNextCluster(unsigned int cluster, unsigned int next, int fat)
 {
-    int bytes = (bits == 32 ? 4 : 2);
-
     if (!validCluster(cluster)) {
         throw string("Trying to access a cluster outside bounds");
     }
 
-    int offset = (float)(cluster * bytes) * (bits == 12 ? 12.0/16.0 : 1.0);
-    int address = fatStart+((fatSize*fat+offset)/bytesPerSector);
+    return (this->*changeNextCluster)(cluster, next, fat);
+}
+
+template<int Bits>
+bool FatSystem::changeNextClusterAs(unsigned int cluster, unsigned int next, int fat)
+{
+    if (!writeMode) {
+        throw string("Trying to write data while write mode is disabled");
+    }
+
+    unsigned long long offset = FatCodec<Bits>::offset(cluster);
+    unsigned long long address = fatStart+((fatSize*fat+offset)/bytesPerSector);
+    unsigned int position = offset%bytesPerSector;
+    int size = position+FatCodec<Bits>::size > bytesPerSector ? 2 : 1;
+
+    // The entry is changed in the write cache, and only written back
+    // on flush(); outside of the FATs, it is written directly
+    vector<char> sector;
+    char *data = writeCache.get(*this, address, size);
+    if (data == NULL) {
+        sector = readData(address, size);
+        data = &sector[0];
+    }
 
-    vector<char> sector = readData(address, bits == 12 ? 2 : 1);
-    char* buffer = &sector[offset%bytesPerSector];
+    FatCodec<Bits>::set(&data[position], cluster, next);
 
-    if (bits == 12) {
-        int bit = cluster*bits;
+    if (sector.empty()) {
+        writeCache.markDirty(address, size);
+    } else if (writeData(address, &sector[0], size) == 0) {
+        return false;
+    }
 
-        if (bit%8 != 0) {
-            buffer[0] = ((next&0x0f)<<4)|(buffer[0]&0x0f);
-            buffer[1] = (next>>4)&0xff;
-        } else {
-            buffer[0] = next&0xff;
-            buffer[1] = (buffer[1]&0xf0)|((next>>8)&0x0f);
-        }
-    } else {
-        for (int i=0; i<(bits/8); i++) {
-            buffer[i] = (next>>(8*i))&0xff;
-        }
+    // The caches only follow the entries that were written
+    if (cacheEnabled && fat == 0) {
+        cache.set(cluster, FatCodec<Bits>::decodeValue(next));
+    }
+    {
+        lock_guard<mutex> lock(directoryCacheLock);
+        directoryCache.clear();
     }
 
-    return writeData(address, &sector[0], bits == 12 ? 2 : 1) != 0;
+    return true;
+}
+
+int FatSystem::flush()
+{
+    return writeCache.flush(*this);
 }
 
 bool FatSystem::validCluster(unsigned int cluster)
@@ -277,20 +601,49 @@ bool FatSystem::validCluster(unsigned int cluster)
 
 unsigned long long FatSystem::clusterAddress(unsigned int cluster, bool isRoot)
 {
-    if (type == FAT32 || !isRoot) {
-        cluster -= 2;
+    // The FAT12/16 root directory is before the clusters
+    if (isRoot && type == FAT16) {
+        return dataStart + sectorsPerCluster*cluster;
+    }
+
+    return clustersStart + sectorsPerCluster*(cluster-2);
+}
+
+vector<FatEntry> FatSystem::getEntries(unsigned int cluster, int *clusters, bool *hasFree)
+{
+    vector<FatEntry> entries;
+
+    if (cluster == 0 && type == FAT32) {
+        cluster = rootDirectory;
     }
 
-    unsigned long long addr = (dataStart + sectorsPerCluster*cluster);
+    if (index.getEntries(cluster, entries, clusters, hasFree)) {
+        return entries;
+    }
+
+    if (index.recording()) {
+        int count = 0;
+        bool free = false;
+        entries = readEntries(cluster, &count, &free);
 
-    if (type == FAT16 && !isRoot) {
-        addr += (rootEntries * FAT_ENTRY_SIZE) / bytesPerSector;
+        // Bad directories are read again, to show the warnings
+        if (!entries.empty()) {
+            index.addDirectory(cluster, entries, count, free);
+        }
+        if (clusters != NULL) {
+            *clusters = count;
+        }
+        if (hasFree != NULL) {
+            *hasFree = free;
+        }
+
+        return entries;
     }
 
-    return addr;
+    return readEntries(cluster, clusters, hasFree);
 }
 
-vector<FatEntry> FatSystem::getEntries(unsigned int cluster, int *clusters, bool *hasFree)
+vector<FatEntry> FatSystem::readEntries(unsigned int cluster, int *clusters, bool *hasFree)
 {
     bool isRoot = false;
     bool contiguous = false;
@@ -299,7 +652,9 @@ vector<FatEntry> FatSystem::getEntries(unsigned int cluster, int *clusters, bool
     bool isValid = false;
     set<unsigned int> visited;
     vector<FatEntry> entries;
+    vector<char> clusterData;
     FatFilename filename;
+    FatSlots slots;
 
     if (clusters != NULL) {
         *clusters = 0;
@@ -327,7 +682,7 @@ vector<FatEntry> FatSystem::getEntries(unsigned int cluster, int *clusters, bool
         bool localZero = false;
         int localFound = 0;
         int localBadEntries = 0;
-        int sectors = isRoot ? rootSectors : sectorsPerCluster;
+        unsigned int sectors = isRoot ? rootSectors : sectorsPerCluster;
         unsigned long long address = clusterAddress(cluster, isRoot);
         if (visited.find(cluster) != visited.end()) {
             cerr << "! Looping directory" << endl;
@@ -336,49 +691,55 @@ vector<FatEntry> FatSystem::getEntries(unsigned int cluster, int *clusters, bool
         visited.insert(cluster);
 
         unsigned int i, j;
+        const char *data = readData(address, sectors, clusterData);
         
         for (j=0; j<sectors; j++) {
-            vector<char> sector = readData(address+j, 1);
             for (i=0; i<bytesPerSector; i+=FAT_ENTRY_SIZE) {
-                char* buffer = &sector[i];
-
-                // Creating entry
-                FatEntry entry;
-
-                entry.attributes = buffer[FAT_ATTRIBUTES];
-                entry.sector = address+j;
-                entry.offset = i;
+                const char* buffer = &data[j*geom.dg_secsize + i];
+                unsigned int slot = (i/FAT_ENTRY_SIZE)%FAT_SLOTS_MAX;
+
+                // The slots are classified by groups, the zero and garbage
+                // ones are then skipped without being decoded
+                if (slot == 0) {
+                    unsigned int count = (bytesPerSector-i+FAT_ENTRY_SIZE-1)/FAT_ENTRY_SIZE;
+                    slots.classify(buffer, count < FAT_SLOTS_MAX ? count : FAT_SLOTS_MAX);
+                }
 
-                if (entry.attributes == FAT_ATTRIBUTES_LONGFILE) {
+                if (FatSlots::has(slots.longName, slot)) {
                     // Long file part
                     filename.append(buffer);
+                } else if (FatSlots::has(slots.zero, slot)) {
+                    // The long name parts before are dropped
+                    filename.clear();
+                    localZero = true;
+                } else if (!FatSlots::has(slots.entry, slot)) {
+                    filename.clear();
+                    localBadEntries++;
+                    badEntries++;
+                    localZero = false;
                 } else {
-                    entry.shortName = string(buffer, 11);
-                    entry.longName = filename.getFilename();
-                    entry.size = FAT_READ_LONG(buffer, FAT_FILESIZE)&0xffffffff;
-                    entry.cluster = (FAT_READ_SHORT(buffer, FAT_CLUSTER_LOW)&0xffff) | (FAT_READ_SHORT(buffer, FAT_CLUSTER_HIGH)<<16);
-                    entry.setData(string(buffer, sizeof(buffer)));
-
-                    if (!entry.isZero()) {
-                        if (entry.isCorrect() && validCluster(entry.cluster)) {
-                            entry.creationDate = FatDate(&buffer[FAT_CREATION_DATE]);
-                            entry.changeDate = FatDate(&buffer[FAT_CHANGE_DATE]);
-                            entries.push_back(entry);
-                            localFound++;
-                            foundEntries++;
-
-                            if (!isValid && entry.getFilename() == "." && entry.cluster == cluster) {
-                                isValid = true;
-                            }
-                        } else {
-                            localBadEntries++;
-                            badEntries++;
+                    // Creating entry, in place, it is dropped if not correct
+                    entries.push_back(FatEntry());
+                    FatEntry &entry = entries.back();
+                    entry.sector = address+j;
+                    entry.offset = i;
+                    entry.setData(buffer);
+                    entry.longName = filename.getFilename(buffer);
+
+                    if (entry.isCorrect() && validCluster(entry.cluster)) {
+                        localFound++;
+                        foundEntries++;
+
+                        if (!isValid && entry.getFilename() == "." && entry.cluster == cluster) {
+                            isValid = true;
                         }
-
-                        localZero = false;
                     } else {
-                        localZero = true;
+                        entries.pop_back();
+                        localBadEntries++;
+                        badEntries++;
                     }
+
+                    localZero = false;
                 }
             }
         }
@@ -417,7 +778,7 @@ vector<FatEntry> FatSystem::getEntries(unsigned int cluster, int *clusters, bool
                 return vector<FatEntry>();
           }
         }
-    } while (cluster != FAT_LAST);
+    } while (cluster != (unsigned int)FAT_LAST);
 
     return entries;
 }
@@ -464,7 +825,7 @@ void FatSystem::list(vector<FatEntry> &entries)
             name += "/";
         }
 
-        printf(" %s ", entry.changeDate.pretty().c_str());
+        printf(" %s ", entry.getChangeDate().pretty().c_str());
         printf(" %-30s", name.c_str());
 
         printf(" c=%u", entry.cluster);
@@ -496,48 +857,295 @@ void FatSystem::readFile(unsigned int cluster, unsigned int size, FILE *f, bool
 #ifdef WIN32
     _setmode(_fileno(f), _O_BINARY);
 #endif
-    while ((size!=0) && cluster!=FAT_LAST) {
-        int currentCluster = cluster;
-        int toRead = size;
-        if (toRead > (bytesPerSector*sectorsPerCluster) || size < 0) {
-            toRead = bytesPerSector*sectorsPerCluster;
-        }
-        vector<char> buffer = readData(clusterAddress(cluster), sectorsPerCluster);
+    vector<char> buffer;
+    unsigned long long bytesPerCluster = bytesPerSector*sectorsPerCluster;
+    unsigned int maxClusters = FAT_READ_AHEAD/sectorsPerCluster;
+    if (maxClusters == 0) {
+        maxClusters = 1;
+    }
 
-        if (size != -1) {
-            size -= toRead;
-        }
+    while ((size!=0) && cluster!=(unsigned int)FAT_LAST) {
+        if (!contiguous) {
+            // The whole chain layout is known ahead
+            vector<FatExtent> extents;
+            unsigned int end;
+            int status = getExtents(cluster, extents, &end);
 
-        // Write file data to the given file
-        fwrite(&buffer[0], toRead, 1, f);
-        fflush(f);
-
-        if (contiguous) {
-            if (deleted) {
-                do {
-                    cluster++;
-                } while (!freeCluster(cluster));
-            } else {
-                if (!freeCluster(cluster)) {
-                    fprintf(stderr, "! Contiguous file contains cluster that seems allocated\n");
-                    fprintf(stderr, "! Trying to disable contiguous mode\n");
-                    contiguous = false;
-                    cluster = nextCluster(cluster);
-                } else {
-                    cluster++;
-                }
+            for (unsigned int i=0; i<extents.size() && size!=0; i++) {
+                readClusters(extents[i].start, extents[i].length, size, f, buffer);
+            }
+
+            if (size == 0 || end == (unsigned int)FAT_LAST) {
+                break;
             }
-        } else {
-            cluster = nextCluster(currentCluster);
 
-            if (cluster == 0) {
+            if (status & FAT_EXTENTS_FREE) {
                 fprintf(stderr, "! One of your file's cluster is 0 (maybe FAT is broken, have a look to -2 and -m)\n");
                 fprintf(stderr, "! Trying to enable contigous mode\n");
                 contiguous = true;
-                cluster = currentCluster+1;
+                cluster = extents.back().start+extents.back().length;
+                continue;
+            }
+
+            if (status & FAT_EXTENTS_LOOP) {
+                fprintf(stderr, "! Loop detected, cluster %u was already read\n", end);
+            } else {
+                fprintf(stderr, "! Cluster %u is outside the disk\n", end);
+            }
+            break;
+        }
+
+        // Following the clusters ahead, the ones that are next to each
+        // other on the disk are read at once
+        unsigned int first = cluster;
+        unsigned long long address = clusterAddress(first);
+        unsigned int count = 0;
+
+        do {
+            count++;
+            cluster = followCluster(cluster, contiguous, deleted);
+        } while (cluster != (unsigned int)FAT_LAST && count < maxClusters
+                && (size == FAT_SIZE_UNKNOWN || count*bytesPerCluster < size)
+                && clusterAddress(cluster) == address+count*sectorsPerCluster);
+
+        readClusters(first, count, size, f, buffer);
+    }
+
+    fflush(f);
+}
+
+void FatSystem::readClusters(unsigned int cluster, unsigned int count, unsigned int &size, FILE *f, vector<char> &buffer)
+{
+    unsigned long long bytesPerCluster = bytesPerSector*sectorsPerCluster;
+    unsigned int maxClusters = FAT_READ_AHEAD/sectorsPerCluster;
+    if (maxClusters == 0 || cluster < 2) {
+        maxClusters = 1;
+    }
+
+    unsigned long long total = count*bytesPerCluster;
+    if (size != FAT_SIZE_UNKNOWN && total > size) {
+        total = size;
+    }
+
+    if (cluster >= 2 && copyData(clusterAddress(cluster), total, f)) {
+        if (size != FAT_SIZE_UNKNOWN) {
+            size -= total;
+        }
+        return;
+    }
+
+    while (count > 0 && size != 0) {
+        unsigned int n = count < maxClusters ? count : maxClusters;
+        unsigned long long bytes = n*bytesPerCluster;
+
+        if (size != FAT_SIZE_UNKNOWN && bytes > size) {
+            bytes = size;
+            n = (size+bytesPerCluster-1)/bytesPerCluster;
+        }
+
+        const char *data = readData(clusterAddress(cluster), n*sectorsPerCluster, buffer);
+
+        // Write file data to the given file
+        fwrite(data, bytes, 1, f);
+
+        if (size != FAT_SIZE_UNKNOWN) {
+            size -= bytes;
+        }
+        cluster += n;
+        count -= n;
+    }
+}
+
+/**
+ * Copies data from a mapped image to a file, in the kernel when
+ * possible; returns false if the data is not in the mapping
+ */
+bool FatSystem::copyData(unsigned long long address, unsigned long long bytes, FILE *f)
+{
+    unsigned long long start = address*geom.dg_secsize;
+
+    if (mapping == NULL || start > mappingSize || bytes > mappingSize-start) {
+        return false;
+    }
+
+#ifndef WIN32
+    int output = fileno(f);
+    off_t offset = globalOffset+start;
+    bool kernelCopy = true;
+
+    // The data already buffered should be written before
+    fflush(f);
+
+    while (bytes > 0 && kernelCopy) {
+        ssize_t n = -1;
+#ifdef FAT_HAVE_COPY_FILE_RANGE
+        n = copy_file_range(mappingFd, &offset, output, NULL, bytes, 0);
+#endif
+#ifdef FAT_HAVE_SENDFILE
+        if (n <= 0) {
+            n = sendfile(output, mappingFd, &offset, bytes);
+        }
+#endif
+        if (n <= 0) {
+            kernelCopy = false;
+        } else {
+            bytes -= n;
+        }
+    }
+
+    start = offset-globalOffset;
+#endif
+
+    // Falling back to a buffered copy
+    if (bytes > 0) {
+        fwrite(mapping+start, bytes, 1, f);
+    }
+
+    return true;
+}
+
+/**
+ * Follows a chain by runs of contiguous clusters, using the in-memory
+ * FAT when it fits, instead of reading a FAT sector per cluster
+ */
+int FatSystem::getExtents(unsigned int cluster, vector<FatExtent> &extents, unsigned int *end)
+{
+    map<unsigned int, unsigned int> visited;
+    int status = 0;
+
+    if (cacheFits()) {
+        lock_guard<mutex> lock(cacheLock);
+
+        // Loaded silently, the file may be read to the standard output
+        if (!cacheEnabled) {
+            loadCache();
+        }
+        cache.computeRuns();
+    }
+
+    extents.clear();
+
+    while (true) {
+        if (!validCluster(cluster)) {
+            status = FAT_EXTENTS_INVALID;
+            break;
+        }
+
+        // The run can't go further than the next known extent
+        map<unsigned int, unsigned int>::iterator it = visited.upper_bound(cluster);
+        unsigned int limit = (it == visited.end() ? totalClusters : it->first) - cluster;
+        if (it != visited.begin()) {
+            it--;
+            if (cluster < it->first+it->second) {
+                status = FAT_EXTENTS_LOOP;
+                break;
+            }
+        }
+
+        unsigned int length = runLength(cluster, limit);
+        extents.push_back(FatExtent(cluster, length));
+        visited[cluster] = length;
+
+        cluster = nextCluster(cluster+length-1);
+        if (cluster == (unsigned int)FAT_LAST) {
+            break;
+        }
+        if (cluster == 0) {
+            status = FAT_EXTENTS_FREE;
+            break;
+        }
+    }
+
+    if (end != NULL) {
+        *end = cluster;
+    }
+
+    return status;
+}
+
+unsigned int FatSystem::runLength(unsigned int cluster, unsigned int limit)
+{
+    if (cacheEnabled) {
+        unsigned int length = cache.runLength(cluster);
+        return length < limit ? length : limit;
+    }
+
+    unsigned int length = 1;
+    while (length < limit && nextCluster(cluster+length-1) == cluster+length) {
+        length++;
+    }
+
+    return length;
+}
+
+int FatSystem::chainSize(int cluster, bool *isContiguous)
+{
+    vector<FatExtent> extents;
+    unsigned int end;
+    int length = 0;
+    int status = getExtents(cluster, extents, &end);
+
+    // A chain pointing to 0 goes on with the first FAT entry
+    if (status & FAT_EXTENTS_FREE) {
+        vector<FatExtent> more;
+        status = getExtents(0, more, &end);
+        extents.insert(extents.end(), more.begin(), more.end());
+    }
+
+    for (unsigned int i=0; i<extents.size(); i++) {
+        length += extents[i].length;
+    }
+
+    if (isContiguous != NULL) {
+        *isContiguous = (extents.size() <= 1);
+    }
+
+    if (status & FAT_EXTENTS_LOOP) {
+        unsigned int last = extents.back().start+extents.back().length-1;
+        cerr << "! Loop detected, " << last << " points to " << end << " that I already met" << endl;
+
+        if (isContiguous != NULL && end != last+1) {
+            *isContiguous = false;
+        }
+    }
+
+    return length;
+}
+
+/**
+ * Next cluster to read in a file, switching between contiguous and
+ * chained modes if the FAT looks wrong
+ */
+unsigned int FatSystem::followCluster(unsigned int cluster, bool &contiguous, bool deleted)
+{
+    if (contiguous) {
+        if (deleted) {
+            do {
+                cluster++;
+            } while (!freeCluster(cluster));
+        } else {
+            if (!freeCluster(cluster)) {
+                fprintf(stderr, "! Contiguous file contains cluster that seems allocated\n");
+                fprintf(stderr, "! Trying to disable contiguous mode\n");
+                contiguous = false;
+                cluster = nextCluster(cluster);
+            } else {
+                cluster++;
             }
         }
+    } else {
+        unsigned int currentCluster = cluster;
+        cluster = nextCluster(currentCluster);
+
+        if (cluster == 0) {
+            fprintf(stderr, "! One of your file's cluster is 0 (maybe FAT is broken, have a look to -2 and -m)\n");
+            fprintf(stderr, "! Trying to enable contigous mode\n");
+            contiguous = true;
+            cluster = currentCluster+1;
+        }
     }
+
+    return cluster;
 }
 
 bool FatSystem::init()
@@ -551,24 +1159,52 @@ bool FatSystem::init()
     totalSize = totalSectors*bytesPerSector;
     fatSize = sectorsPerFat*bytesPerSector;
     totalClusters = (fatSize*8)/bits;
-    dataSize = totalClusters*bytesPerSector*sectorsPerCluster;
 
+    clustersStart = dataStart;
     if (type == FAT16) {
         rootSectors = rootEntries*32/bytesPerSector;
+        clustersStart += (rootEntries * FAT_ENTRY_SIZE) / bytesPerSector;
+    }
+
+    // Clusters that are actually in the data area, the FAT can be larger
+    dataClusters = 0;
+    if (totalSectors > clustersStart && sectorsPerCluster) {
+        dataClusters = (totalSectors-clustersStart)/sectorsPerCluster;
+    }
+    if (totalClusters < 2) {
+        dataClusters = 0;
+    } else if (dataClusters > totalClusters-2) {
+        dataClusters = totalClusters-2;
+    }
+    dataSize = dataClusters*bytesPerSector*sectorsPerCluster;
+
+    if (bits == 12) {
+        readNextCluster = &FatSystem::readNextClusterAs<12>;
+        changeNextCluster = &FatSystem::changeNextClusterAs<12>;
+    } else if (bits == 16) {
+        readNextCluster = &FatSystem::readNextClusterAs<16>;
+        changeNextCluster = &FatSystem::changeNextClusterAs<16>;
+    } else {
+        readNextCluster = &FatSystem::readNextClusterAs<32>;
+        changeNextCluster = &FatSystem::changeNextClusterAs<32>;
     }
 
+    // FAT12 entries can be across two sectors, each table is then
+    // kept as a whole
+    writeCache.setArea(fatStart, fats*sectorsPerFat,
+            bits == 12 ? sectorsPerFat : FAT_TABLE_CHUNK, geom.dg_secsize);
+
     return strange == 0;
 }
 
-void FatSystem::infos()
+void FatSystem::infos(bool verify)
 {
-    int bytesPerCluster = sectorsPerCluster*bytesPerSector;
     cout << "FAT Filesystem information" << endl << endl;
 
     cout << "Filesystem type: " << fsType << endl;
     cout << "OEM name: " << oemName << endl;
     cout << "Total sectors: " << totalSectors << endl;
-    cout << "Total data clusters: " << totalClusters << endl;
+    cout << "Total data clusters: " << dataClusters << endl;
     cout << "Data size: " << dataSize << " (" << prettySize(dataSize) << ")" << endl;
     cout << "Disk size: " << totalSize << " (" << prettySize(totalSize) << ")" << endl;
     cout << "Bytes per sector: " << bytesPerSector << endl;
@@ -587,44 +1223,120 @@ void FatSystem::infos()
     cout << "Disk label: " << diskLabel << endl;
     cout << endl;
 
-    computeStats();
-    cout << "Free clusters: " << freeClusters << "/" << totalClusters;
-    cout << " (" << (100*freeClusters/(double)totalClusters) << "%)" << endl;
-    cout << "Free space: " << (freeClusters*bytesPerCluster) <<
-        " (" << prettySize(freeClusters*bytesPerCluster) << ")" << endl;
-    cout << "Used space: " << ((totalClusters-freeClusters)*bytesPerCluster) <<
-        " (" << prettySize((totalClusters-freeClusters)*bytesPerCluster) << ")" << endl;
+    // The FSInfo count is kept by the system, the FAT is then not read;
+    // it is only a hint, the FAT is the reference
+    bool useFsInfo = type == FAT32 && hasFsInfo && !verify
+        && fsInfoFree != FAT_FSINFO_UNKNOWN && fsInfoFree <= dataClusters;
+
+    if (useFsInfo) {
+        showUsage("Free clusters (FSInfo)", fsInfoFree, dataClusters);
+        if (fsInfoNextFree != FAT_FSINFO_UNKNOWN) {
+            cout << "Next free cluster (FSInfo): " << fsInfoNextFree << endl;
+        }
+    } else if (verify) {
+        computeStats();
+        unsigned long long free = freeClusters;
+        showUsage("Free clusters", free, dataClusters);
+
+        if (type == FAT32 && hasFsInfo) {
+            cout << "FSInfo free clusters: ";
+            if (fsInfoFree == FAT_FSINFO_UNKNOWN) {
+                cout << "unknown" << endl;
+            } else if (fsInfoFree == free) {
+                cout << fsInfoFree << " (matches the FAT)" << endl;
+            } else {
+                cout << fsInfoFree << " (MISMATCH, the FAT has " << free << ")" << endl;
+            }
+
+            // The hint is where to start looking for free clusters, often
+            // the last allocated one
+            cout << "FSInfo next free cluster: ";
+            if (fsInfoNextFree == FAT_FSINFO_UNKNOWN) {
+                cout << "unknown" << endl;
+            } else if (fsInfoNextFree < 2 || fsInfoNextFree >= 2+dataClusters) {
+                cout << fsInfoNextFree << " (outside of the data area)" << endl;
+            } else {
+                cout << fsInfoNextFree << endl;
+            }
+        }
+    } else {
+        computeStats();
+        showUsage("Free clusters", freeClusters, dataClusters);
+    }
     cout << endl;
 }
 
+void FatSystem::showUsage(string label, unsigned long long free, unsigned long long total)
+{
+    unsigned long long bytesPerCluster = sectorsPerCluster*bytesPerSector;
+
+    cout << label << ": " << free << "/" << total;
+    cout << " (" << (100*free/(double)total) << "%)" << endl;
+    cout << "Free space: " << (free*bytesPerCluster) <<
+        " (" << prettySize(free*bytesPerCluster) << ")" << endl;
+    cout << "Used space: " << ((total-free)*bytesPerCluster) <<
+        " (" << prettySize((total-free)*bytesPerCluster) << ")" << endl;
+}
+
+bool FatSystem::lookupEntry(unsigned int cluster, const string &name, bool directory, FatEntry &entry)
+{
+    lock_guard<mutex> lock(directoryCacheLock);
+    FatDirectoryCache::Directory *listing = directoryCache.get(cluster);
+
+    if (listing == NULL) {
+        vector<FatEntry> entries = getEntries(cluster);
+        listing = &directoryCache.put(cluster, entries);
+    }
+
+    unordered_map<string, vector<unsigned int> >::iterator it = listing->names.find(name);
+    if (it == listing->names.end()) {
+        return false;
+    }
+
+    vector<unsigned int> &positions = it->second;
+    bool found = false;
+
+    // The last directory having the name is used, while the first file
+    // that is not empty is preferred
+    for (unsigned int i=0; i<positions.size(); i++) {
+        FatEntry &candidate = listing->entries[positions[i]];
+
+        if (directory) {
+            if (candidate.isDirectory()) {
+                entry = candidate;
+                found = true;
+            }
+        } else {
+            entry = candidate;
+            found = true;
+
+            if (candidate.size != 0) {
+                break;
+            }
+        }
+    }
+
+    return found;
+}
+
 bool FatSystem::findDirectory(FatPath &path, FatEntry &outputEntry)
 {
-    int cluster;
+    unsigned int cluster;
     vector<string> parts = path.getParts();
     cluster = rootDirectory;
     outputEntry.cluster = cluster;
 
-    for (int i=0; i<parts.size(); i++) {
+    for (unsigned int i=0; i<parts.size(); i++) {
         if (parts[i] != "") {
-            parts[i] = strtolower(parts[i]);
-            vector<FatEntry> entries = getEntries(cluster);
-            vector<FatEntry>::iterator it;
-            bool found = false;
-
-            for (it=entries.begin(); it!=entries.end(); it++) {
-                FatEntry &entry = *it;
-                string name = entry.getFilename();
-                if (entry.isDirectory() && strtolower(name) == parts[i]) {
-                    outputEntry = entry;
-                    cluster = entry.cluster;
-                    found = true;
-                }
-            }
+            FatEntry entry;
 
-            if (!found) {
+            if (!lookupEntry(cluster, strtolower(parts[i]), true, entry)) {
                 cerr << "Error: directory " << path.getPath() << " not found" << endl;
                 return false;
             }
+
+            outputEntry = entry;
+            cluster = entry.cluster;
         }
     }
 
@@ -633,32 +1345,14 @@ bool FatSystem::findDirectory(FatPath &path, FatEntry &outputEntry)
 
 bool FatSystem::findFile(FatPath &path, FatEntry &outputEntry)
 {
-    bool found = false;
-    string dirname = path.getDirname();
-    string basename = path.getBasename();
-    basename = strtolower(basename);
-
-    FatPath parent(dirname);
+    FatPath parent(path.getDirname());
     FatEntry parentEntry;
-    if (findDirectory(parent, parentEntry)) {
-        vector<FatEntry> entries = getEntries(parentEntry.cluster);
-        vector<FatEntry>::iterator it;
 
-        for (it=entries.begin(); it!=entries.end(); it++) {
-            FatEntry &entry = (*it);
-            if (strtolower(entry.getFilename()) == basename) {
-                outputEntry = entry;
-
-                if (entry.size == 0) {
-                    found = true;
-                } else {
-                    return true;
-                }
-            }
-        }
+    if (findDirectory(parent, parentEntry)) {
+        return lookupEntry(parentEntry.cluster, strtolower(path.getBasename()), false, outputEntry);
     }
 
-    return found;
+    return false;
 }
 
 void FatSystem::readFile(FatPath &path, FILE *f)
@@ -677,6 +1371,24 @@ void FatSystem::readFile(FatPath &path, FILE *f)
             fprintf(stderr, "! File not found\n");
 }
 
+void FatSystem::readFiles(string listFile, FILE *f)
+{
+    ifstream file(listFile.c_str());
+    if (!file) {
+        ostringstream oss;
+        oss << "Unable to open file " << listFile << " for reading";
+        throw oss.str();
+    }
+
+    string line;
+    while (getline(file, line)) {
+        if (line != "") {
+            FatPath path(line);
+            readFile(path, f);
+        }
+    }
+}
+
 void FatSystem::setListDeleted(bool listDeleted_)
 {
     listDeleted = listDeleted_;
@@ -699,38 +1411,227 @@ bool FatSystem::freeCluster(unsigned int cluster)
 
 void FatSystem::computeStats()
 {
+    lock_guard<mutex> lock(statsLock);
+
     if (statsComputed) {
         return;
     }
 
+    // Only the clusters of the data area can be allocated
+    unsigned long long end = 2+dataClusters;
+    if (cacheEnabled && end <= cache.entries.size()) {
+        freeClusters = count(cache.entries.begin()+2, cache.entries.begin()+end, 0);
+    } else {
+        freeClusters = countFreeClusters(2, end);
+    }
+
     statsComputed = true;
+}
+
+unsigned long long FatSystem::countFreeClusters(unsigned int first, unsigned int end)
+{
+    if (end > totalClusters) {
+        end = totalClusters;
+    }
+    if (first >= end) {
+        return 0;
+    }
+
+    if (bits == 12) {
+        return countFreeClustersAs<12>(first, end);
+    } else if (bits == 16) {
+        return countFreeClustersAs<16>(first, end);
+    } else {
+        return countFreeClustersAs<32>(first, end);
+    }
+}
 
-    freeClusters = 0;
-    for (unsigned int cluster=0; cluster<totalClusters; cluster++) {
-        if (freeCluster(cluster)) {
-            freeClusters++;
+template<int Bits>
+unsigned long long FatSystem::countFreeClustersAs(unsigned int first, unsigned int end)
+{
+    unsigned long long total = 0;
+    vector<char> buffer;
+    unsigned int cluster = first;
+
+    // FAT12 entries are read from an even one, to be byte-aligned
+    if (Bits == 12 && (cluster&1)) {
+        total += freeCluster(cluster);
+        cluster++;
+    }
+
+    while (cluster < end) {
+        unsigned int count = end-cluster < FAT_CODEC_CHUNK ? end-cluster : FAT_CODEC_CHUNK;
+        total += FatCodec<Bits>::readFree(*this, 0, cluster, count, buffer);
+        if (count == 0) {
+            break;
         }
+        cluster += count;
     }
+
+    return total;
 }
 
-void FatSystem::rewriteUnallocated(bool random)
+void FatSystem::freeExtents(vector<FatExtent> &extents)
 {
-    int total = 0;
-    srand(time(NULL));
-    for (int cluster=0; cluster<totalClusters; cluster++) {
-        if (freeCluster(cluster)) {
-            char buffer[bytesPerSector*sectorsPerCluster];
-            for (int i=0; i<sizeof(buffer); i++) {
-                if (random) {
-                    buffer[i] = rand()&0xff;
-                } else {
-                    buffer[i] = 0x0;
+    extents.clear();
+
+    if (bits == 12) {
+        freeExtentsAs<12>(extents);
+    } else if (bits == 16) {
+        freeExtentsAs<16>(extents);
+    } else {
+        freeExtentsAs<32>(extents);
+    }
+}
+
+template<int Bits>
+void FatSystem::freeExtentsAs(vector<FatExtent> &extents)
+{
+    vector<uint32_t> values(FAT_CODEC_CHUNK);
+    vector<char> buffer;
+    unsigned int end = 2+dataClusters;
+    unsigned int cluster = 0, count;
+
+    while (cluster < end
+            && (count = FatCodec<Bits>::read(*this, 0, cluster, &values[0], FAT_CODEC_CHUNK, buffer))) {
+        for (unsigned int i=(cluster < 2 ? 2 : 0); i<count && cluster+i<end; i++) {
+            if (values[i] != 0) {
+                continue;
+            }
+
+            if (extents.size() && extents.back().start+extents.back().length == cluster+i) {
+                extents.back().length++;
+            } else {
+                extents.push_back(FatExtent(cluster+i, 1));
+            }
+        }
+        cluster += count;
+    }
+}
+
+bool FatSystem::discardSectors(int discardFd, bool device, unsigned long long address, unsigned long long size)
+{
+#ifdef FAT_HAVE_DISCARD
+    uint64_t range[2] = {globalOffset+address*geom.dg_secsize, size*geom.dg_secsize};
+
+    // A plain discard leaves the content of the sectors up to the device,
+    // they are zeroed out instead, which the device can still do by
+    // unmapping them
+    if (device) {
+        return ioctl(discardFd, BLKZEROOUT, range) == 0;
+    }
+
+    return fallocate(discardFd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, range[0], range[1]) == 0;
+#else
+    return false;
+#endif
+}
+
+/**
+ * The free clusters are wiped by runs, with writes of at most
+ * FAT_WIPE_CHUNK bytes, aligned on it from the start of the disk
+ */
+void FatSystem::rewriteUnallocated(int mode)
+{
+    vector<FatExtent> extents;
+    freeExtents(extents);
+
+    unsigned long long total = 0;
+    for (unsigned int i=0; i<extents.size(); i++) {
+        total += extents[i].length*sectorsPerCluster;
+    }
+
+    // Discarding needs to reach the file or the device directly
+    int discardFd = -1;
+    bool device = false;
+    if (mode == FAT_WIPE_DISCARD) {
+        struct stat st;
+        if (rawImage()) {
+            discardFd = open(filename.c_str(), O_RDWR);
+        }
+        if (discardFd >= 0 && fstat(discardFd, &st) == 0) {
+            device = S_ISBLK(st.st_mode);
+        }
+        if (discardFd < 0) {
+            cerr << "! Unable to discard the sectors of this image, writing zeros" << endl;
+        }
+    }
+
+    unsigned long long seed = time(NULL)^((unsigned long long)getpid()<<32);
+    ifstream urandom("/dev/urandom", ios::binary);
+    urandom.read((char *)&seed, sizeof(seed));
+    FatRandom random(seed);
+
+    unsigned long long chunk = FAT_WIPE_CHUNK/bytesPerSector;
+    vector<char> buffer(chunk*bytesPerSector);
+    vector<char> zeros;
+    unsigned long long done = 0, discarded = 0;
+    bool progress = isatty(STDERR_FILENO);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point report = start;
+
+    // The partition can start anywhere on the disk
+    unsigned long long offset = globalOffset/bytesPerSector;
+
+    for (unsigned int i=0; i<extents.size(); i++) {
+        unsigned long long address = clusterAddress(extents[i].start);
+        unsigned long long left = extents[i].length*sectorsPerCluster;
+
+        while (left) {
+            unsigned long long size = chunk-(offset+address)%chunk;
+            if (size > left) {
+                size = left;
+            }
+
+            if (discardFd >= 0 && discardSectors(discardFd, device, address, size)) {
+                // The sectors now read as zeros, keeping the cache coherent
+                lock_guard<mutex> lock(blockCacheLock);
+                zeros.resize(buffer.size());
+                blockCache.update(address, &zeros[0], size, geom.dg_secsize);
+                discarded += size;
+            } else {
+                if (discardFd >= 0 && discarded == 0) {
+                    cerr << "! Discarding is not supported here, writing zeros" << endl;
+                    close(discardFd);
+                    discardFd = -1;
                 }
+                if (mode == FAT_WIPE_RANDOM) {
+                    random.fill(&buffer[0], size*bytesPerSector);
+                }
+                writeData(address, &buffer[0], size);
+            }
+
+            address += size;
+            left -= size;
+            done += size;
+
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            if (progress && now-report >= chrono::seconds(1)) {
+                double elapsed = chrono::duration<double>(now-start).count();
+                cerr << "Wiping: " << (100*done/total) << "% ("
+                    << prettySize(done*bytesPerSector) << "/" << prettySize(total*bytesPerSector) << "), "
+                    << prettySize(done*bytesPerSector/elapsed) << "/s     \r" << std::flush;
+                report = now;
             }
-            writeData(clusterAddress(cluster), buffer, sectorsPerCluster);
-            total++;
         }
     }
 
-    cout << "Scrambled " << total << " sectors" << endl;
+    if (discardFd >= 0) {
+        close(discardFd);
+    }
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    if (progress && report != start) {
+        cerr << endl;
+    }
+
+    cout << "Wiped " << done << " sectors in " << extents.size() << " runs";
+    if (discarded) {
+        cout << " (" << discarded << " discarded)";
+    }
+    if (elapsed > 0) {
+        cout << ", " << prettySize(done*bytesPerSector/elapsed) << "/s";
+    }
+    cout << endl;
 }
@@ -1,18 +1,29 @@
 #ifndef _FATCAT_FATSYSTEM_H
 #define _FATCAT_FATSYSTEM_H
 
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <libdsk.h>
 #include "FatEntry.h"
 #include "FatPath.h"
+#include "FatTable.h"
+#include "FatIndex.h"
+#include "FatExtent.h"
+#include "FatBlockCache.h"
+#include "FatDirectoryCache.h"
+#include "FatWriteCache.h"
 
 using namespace std;
 
 // Last cluster
 #define FAT_LAST (-1)
 
+// Size given to readFile() to read a chain until its end
+#define FAT_SIZE_UNKNOWN ((unsigned int)-1)
+
 // Header offsets
 #define FAT_BYTES_PER_SECTOR        0x0b
 #define FAT_SECTORS_PER_CLUSTER     0x0d
@@ -21,28 +32,63 @@ using namespace std;
 #define FAT_TOTAL_SECTORS           0x20
 #define FAT_SECTORS_PER_FAT         0x24
 #define FAT_ROOT_DIRECTORY          0x2c
+#define FAT_DISK_ID                 0x43
 #define FAT_DISK_LABEL              0x47
 #define FAT_DISK_LABEL_SIZE         11
 #define FAT_DISK_OEM                0x3
 #define FAT_DISK_OEM_SIZE           8
 #define FAT_DISK_FS                 0x52
 #define FAT_DISK_FS_SIZE            8
-#define FAT_CREATION_DATE           0x10
-#define FAT_CHANGE_DATE             0x16
 
 #define FAT16_SECTORS_PER_FAT       0x16
 #define FAT16_DISK_FS               0x36
 #define FAT16_DISK_FS_SIZE          8
+#define FAT16_DISK_ID               0x27
 #define FAT16_DISK_LABEL            0x2b
 #define FAT16_DISK_LABEL_SIZE       11
 #define FAT16_TOTAL_SECTORS         0x13
 #define FAT16_ROOT_ENTRIES          0x11
 
+// FAT32 FSInfo sector, keeping the free clusters count
+#define FAT_FSINFO_SECTOR           0x30
+#define FAT_FSINFO_LEAD             0x000
+#define FAT_FSINFO_STRUCT           0x1e4
+#define FAT_FSINFO_FREE             0x1e8
+#define FAT_FSINFO_NEXT_FREE        0x1ec
+#define FAT_FSINFO_TRAIL            0x1fc
+#define FAT_FSINFO_LEAD_SIGNATURE   0x41615252
+#define FAT_FSINFO_STRUCT_SIGNATURE 0x61417272
+#define FAT_FSINFO_TRAIL_SIGNATURE  0xaa550000
+#define FAT_FSINFO_UNKNOWN          0xffffffff
+
 #define FAT32 0
 #define FAT16 1
 
+// Maximum number of sectors read at once by readFile()
+#define FAT_READ_AHEAD  8192
+
+// Ways a chain can end, besides FAT_LAST (see getExtents())
+#define FAT_EXTENTS_LOOP        1
+#define FAT_EXTENTS_INVALID     2
+#define FAT_EXTENTS_FREE        4
+
+// FATs up to this size (in bytes) are cached to follow chains (see cacheFits())
+#define FAT_EXTENTS_MAX_TABLE   (64*1024*1024)
+
+// Ways to wipe the unallocated clusters (see rewriteUnallocated())
+#define FAT_WIPE_ZERO       0
+#define FAT_WIPE_RANDOM     1
+#define FAT_WIPE_DISCARD    2
+
+// Largest write done when wiping (in bytes), the writes are aligned on it
+#define FAT_WIPE_CHUNK      (4*1024*1024)
+
 /**
  * A FAT fileSystem
+ *
+ * Once init() is done, the reading methods (readData(), nextCluster(),
+ * getEntries(), getExtents()...) can be called from several threads at
+ * once, as long as no thread writes meanwhile
  */
 class FatSystem
 {
@@ -63,9 +109,10 @@ class FatSystem
         void list(FatPath &path);
 
         /**
-         * Display infos about FAT
+         * Display infos about FAT, the free clusters are taken from the
+         * FAT32 FSInfo sector unless verify is set
          */
-        void infos();
+        void infos(bool verify = false);
 
         /**
          * Find a directory or a file
@@ -79,6 +126,11 @@ class FatSystem
         void readFile(FatPath &path, FILE *f = NULL);
         void readFile(unsigned int cluster, unsigned int size, FILE * f = NULL, bool deleted = false);
 
+        /**
+         * Reads the files whose paths are listed in a file, one per line
+         */
+        void readFiles(string listFile, FILE *f = NULL);
+
         /**
          * Showing deleted file in listing
          */
@@ -89,6 +141,12 @@ class FatSystem
          */
         bool freeCluster(unsigned int cluster);
 
+        /**
+         * Number of free clusters from first to end (excluded), reading
+         * the first FAT by large blocks
+         */
+        unsigned long long countFreeClusters(unsigned int first, unsigned int end);
+
         /**
          * Returns the cluster offset in the filesystem
          */
@@ -99,6 +157,23 @@ class FatSystem
          */
         void enableCache();
 
+        /**
+         * The decoded first FAT, the cache is enabled to get it
+         */
+        FatTable &getTable();
+
+        /**
+         * Is the FAT small enough, or indexed, to be cached when following
+         * a lot of chains?
+         */
+        bool cacheFits();
+
+        /**
+         * Enable the sectors cache, using at most the given size in MB; it
+         * is only used once the image is not mapped anymore
+         */
+        void enableBlockCache(unsigned long long megabytes);
+
         // File descriptor
         string filename;
         unsigned long long globalOffset;
@@ -106,8 +181,13 @@ class FatSystem
         DSK_GEOMETRY geom;
         bool writeMode;
 
+        // Memory mapping of raw images, starting at globalOffset
+        const char *mapping;
+        unsigned long long mappingSize;
+
         // Header values
         int type;
+        uint32_t diskId;
         string diskLabel;
         string oemName;
         string fsType;
@@ -126,17 +206,37 @@ class FatSystem
         unsigned long long rootEntries;
         unsigned long long rootSectors;
 
+        // Specific to FAT32, the FSInfo sector, if its signatures are there
+        unsigned long long fsInfoSector;
+        bool hasFsInfo;
+        unsigned long long fsInfoFree;
+        unsigned long long fsInfoNextFree;
+
         // Computed values
         unsigned long long fatStart;
         unsigned long long dataStart;
+        unsigned long long clustersStart;
         unsigned long long totalSize;
         unsigned long long dataSize;
         unsigned long long fatSize;
         unsigned long long totalClusters;
+        unsigned long long dataClusters;
 
         // FAT Cache
-        bool cacheEnabled;
-        map<int, int> cache;
+        atomic<bool> cacheEnabled;
+        FatTable cache;
+
+        // Sectors cache, below readData()
+        FatBlockCache blockCache;
+
+        // Directories used to resolve paths
+        FatDirectoryCache directoryCache;
+
+        // Pending FAT writes
+        FatWriteCache writeCache;
+
+        // Index file, used instead of reading the FAT and the directories
+        FatIndex index;
 
         // Stats values
         bool statsComputed;
@@ -155,6 +255,12 @@ class FatSystem
          */
         bool writeNextCluster(unsigned int cluster, unsigned int next, int fat=0);
 
+        /**
+         * Writes the pending FAT changes to the disk, returns the number
+         * of writes
+         */
+        int flush();
+
         /**
          * Is this cluster valid?
          */
@@ -171,6 +277,13 @@ class FatSystem
          */
         vector<char> readData(unsigned long long address, int size);
 
+        /**
+         * Read some data from the system, without copy when the image
+         * is mapped; the returned pointer is valid until the next call
+         * using the same buffer
+         */
+        const char *readData(unsigned long long address, int size, vector<char> &buffer);
+
         /**
          * Write some data to the system, write should be enabled
          */
@@ -182,9 +295,26 @@ class FatSystem
         vector<FatEntry> getEntries(unsigned int cluster, int *clusters = NULL, bool *hasFree = NULL);
 
         /**
-         * Write random data in unallocated sectors
+         * Wipes the unallocated clusters, writing zeros or random data
+         * (FAT_WIPE_*); with FAT_WIPE_DISCARD, holes are punched in image
+         * files and devices zero the sectors out themselves, zeros being
+         * written if this is not supported
+         */
+        void rewriteUnallocated(int mode = FAT_WIPE_ZERO);
+
+        /**
+         * Runs of free clusters in the data area, from one pass over the
+         * first FAT
          */
-        void rewriteUnallocated(bool random=false);
+        void freeExtents(vector<FatExtent> &extents);
+
+        /**
+         * Layout of the chain starting at a cluster, as runs of
+         * contiguous clusters, the FAT is cached when cacheFits();
+         * returns 0 if the chain properly ends,
+         * or FAT_EXTENTS_* flags, end is set to the value that stopped it
+         */
+        int getExtents(unsigned int cluster, vector<FatExtent> &extents, unsigned int *end = NULL);
 
         /**
          * Return a chain size
@@ -198,11 +328,116 @@ class FatSystem
     
     protected:
         void parseHeader();
+        void parseFsInfo();
+
+        /**
+         * Loads the first FAT in the cache, from the index if it can;
+         * cacheLock has to be held
+         */
+        void loadCache();
+
+        /**
+         * Finds an entry by lowercased name in a directory, through the
+         * directory cache
+         */
+        bool lookupEntry(unsigned int cluster, const string &name, bool directory, FatEntry &entry);
+
+        /**
+         * Reads the entries of a directory from the disk
+         */
+        vector<FatEntry> readEntries(unsigned int cluster, int *clusters, bool *hasFree);
+
+        /**
+         * Next cluster of a file being read
+         */
+        unsigned int followCluster(unsigned int cluster, bool &contiguous, bool deleted);
+
+        /**
+         * Writes count clusters, contiguous on the disk, to a file
+         */
+        void readClusters(unsigned int cluster, unsigned int count, unsigned int &size, FILE *f, vector<char> &buffer);
+
+        /**
+         * Number of clusters following each other from the given one,
+         * at most limit
+         */
+        unsigned int runLength(unsigned int cluster, unsigned int limit);
+
+        /**
+         * Copies bytes of the mapped image to a file
+         */
+        bool copyData(unsigned long long address, unsigned long long bytes, FILE *f);
+
+        /**
+         * Is the image a plain raw file, its logical sectors following
+         * each other?
+         */
+        bool rawImage();
+
+        /**
+         * Maps the image in memory if it is a plain raw file
+         */
+        void mapImage();
+        void unmapImage();
+
+        /**
+         * Pointer to some sectors in the mapping, NULL if not mapped
+         */
+        const char *mappedData(unsigned long long address, int size);
+
+        /**
+         * Reads sectors from the driver, reporting unreadable ones
+         */
+        void readSectors(unsigned long long address, int size, char *buffer);
+        void readCached(unsigned long long address, int size, char *buffer);
+
+        void *mappingBase;
+        size_t mappingLength;
+        int mappingFd;
+
+        // Capacity of the sectors cache, in blocks
+        unsigned long long blockCacheCapacity;
+
+        // Drivers other than the raw one are not reentrant
+        bool driverReentrant;
+        mutex driverLock;
+        mutex blockCacheLock;
+        mutex directoryCacheLock;
+        mutex cacheLock;
+        mutex statsLock;
+
+        // Access to the entries, for the width of the FAT (see FatCodec),
+        // selected in init()
+        unsigned int (FatSystem::*readNextCluster)(unsigned int cluster, int fat);
+        bool (FatSystem::*changeNextCluster)(unsigned int cluster, unsigned int next, int fat);
+
+        template<int Bits>
+        unsigned int readNextClusterAs(unsigned int cluster, int fat);
+        template<int Bits>
+        bool changeNextClusterAs(unsigned int cluster, unsigned int next, int fat);
 
         /**
          * Compute the free clusters stats
          */
         void computeStats();
+
+        template<int Bits>
+        unsigned long long countFreeClustersAs(unsigned int first, unsigned int end);
+
+        template<int Bits>
+        void freeExtentsAs(vector<FatExtent> &extents);
+
+        /**
+         * Deallocates some sectors of the image file (punching a hole)
+         * or zeroes them out on the device, so that they read as zeros
+         * afterwards; false if not supported
+         */
+        bool discardSectors(int discardFd, bool device, unsigned long long address, unsigned long long size);
+
+        /**
+         * Displays the free and used space
+         */
+        void showUsage(string label, unsigned long long free, unsigned long long total);
 };
 
 #endif // _FATCAT_FATSYSTEM_H
@@ -0,0 +1,105 @@
+#include <vector>
+
+#include "FatSystem.h"
+#include "FatCodec.h"
+#include "FatTable.h"
+
+using namespace std;
+
+FatTable::FatTable()
+{
+}
+
+void FatTable::load(FatSystem &system, int fat)
+{
+    unsigned int count = system.totalClusters;
+    unsigned long long chunk = FAT_TABLE_CHUNK;
+    unsigned long long start = system.fatStart + system.sectorsPerFat*fat;
+    unsigned int cluster = 0;
+
+    // FAT12 entries are not byte-aligned, the table is small enough
+    // to be read at once
+    if (system.bits == 12) {
+        chunk = system.sectorsPerFat;
+    }
+
+    entries.resize(count);
+    runs.clear();
+
+    vector<char> buffer;
+    for (unsigned long long sector=0; sector<system.sectorsPerFat && cluster<count; sector+=chunk) {
+        unsigned long long toRead = chunk;
+        if (sector+toRead > system.sectorsPerFat) {
+            toRead = system.sectorsPerFat-sector;
+        }
+
+        const char *data = system.readData(start+sector, toRead, buffer);
+        unsigned int n = (toRead*system.geom.dg_secsize*8)/system.bits;
+        if (cluster+n > count) {
+            n = count-cluster;
+        }
+
+        decode(system.bits, data, &entries[cluster], n);
+        cluster += n;
+    }
+}
+
+void FatTable::decode(unsigned int bits, const char *data, uint32_t *output, unsigned int count)
+{
+    if (bits == 32) {
+        FatCodec<32>::decode(data, output, count);
+    } else if (bits == 16) {
+        FatCodec<16>::decode(data, output, count);
+    } else {
+        FatCodec<12>::decode(data, output, count);
+    }
+}
+
+void FatTable::assign(const uint32_t *values, unsigned int count)
+{
+    entries.assign(values, values+count);
+    runs.clear();
+}
+
+void FatTable::set(unsigned int cluster, uint32_t value)
+{
+    entries[cluster] = value;
+
+    // Only the run starting at this cluster and the ones leading to it
+    // change
+    if (!runs.empty()) {
+        if (cluster+1 < entries.size() && value == cluster+1) {
+            runs[cluster] = runs[cluster+1]+1;
+        } else {
+            runs[cluster] = 1;
+        }
+
+        for (unsigned int i=cluster; i>0 && entries[i-1] == i; i--) {
+            runs[i-1] = runs[i]+1;
+        }
+    }
+}
+
+unsigned int FatTable::runLength(unsigned int cluster)
+{
+    computeRuns();
+
+    return runs[cluster];
+}
+
+void FatTable::computeRuns()
+{
+    if (runs.empty() && !entries.empty()) {
+        // Computed backward, each run is one longer than the following
+        runs.resize(entries.size());
+        runs[entries.size()-1] = 1;
+        for (unsigned int i=entries.size()-1; i>0; i--) {
+            runs[i-1] = (entries[i-1] == i) ? runs[i]+1 : 1;
+        }
+    }
+}
+
+unsigned int FatTable::size()
+{
+    return entries.size();
+}
@@ -0,0 +1,63 @@
+#ifndef _FATCAT_FATTABLE_H
+#define _FATCAT_FATTABLE_H
+
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+// Number of sectors read at once when loading a table
+#define FAT_TABLE_CHUNK     2048
+
+class FatSystem;
+
+/**
+ * An in-memory copy of one file allocation table, decoded to a flat
+ * array of next cluster values (FAT_LAST for ends of chains)
+ */
+class FatTable
+{
+    public:
+        FatTable();
+
+        /**
+         * Loads the n-th FAT of the system using large sequential reads
+         */
+        void load(FatSystem &system, int fat=0);
+
+        /**
+         * Decodes count raw entries of a bits-wide FAT, see FatCodec
+         */
+        static void decode(unsigned int bits, const char *data, uint32_t *output, unsigned int count);
+
+        /**
+         * Uses already decoded entries
+         */
+        void assign(const uint32_t *values, unsigned int count);
+
+        /**
+         * Changes an entry
+         */
+        void set(unsigned int cluster, uint32_t value);
+
+        /**
+         * Number of clusters, starting from the given one, that
+         * are each followed by the next one in the chain
+         */
+        unsigned int runLength(unsigned int cluster);
+
+        /**
+         * Computes the run lengths, if they are not already
+         */
+        void computeRuns();
+
+        unsigned int size();
+
+        vector<uint32_t> entries;
+
+    protected:
+        // Run lengths, computed on demand
+        vector<uint32_t> runs;
+};
+
+#endif // _FATCAT_FATTABLE_H
@@ -0,0 +1,82 @@
+#include "FatWorkQueue.h"
+
+using namespace std;
+
+FatWorkQueue::FatWorkQueue(int workers)
+    : queues(workers),
+    locks(workers),
+    pending(0),
+    available(0)
+{
+}
+
+void FatWorkQueue::push(int worker, unsigned int cluster)
+{
+    pending++;
+    {
+        lock_guard<mutex> lock(locks[worker]);
+        queues[worker].push_front(cluster);
+    }
+    available++;
+
+    lock_guard<mutex> lock(waitLock);
+    waiting.notify_one();
+}
+
+bool FatWorkQueue::take(int worker, unsigned int &cluster, bool steal)
+{
+    lock_guard<mutex> lock(locks[worker]);
+    deque<unsigned int> &queue = queues[worker];
+
+    if (queue.empty()) {
+        return false;
+    }
+
+    // The owner goes depth-first, thieves take the oldest tasks which
+    // are likely to be the biggest subtrees
+    if (steal) {
+        cluster = queue.back();
+        queue.pop_back();
+    } else {
+        cluster = queue.front();
+        queue.pop_front();
+    }
+    available--;
+
+    return true;
+}
+
+bool FatWorkQueue::pop(int worker, unsigned int &cluster)
+{
+    int workers = queues.size();
+
+    while (true) {
+        if (take(worker, cluster, false)) {
+            return true;
+        }
+
+        for (int i=1; i<workers; i++) {
+            if (take((worker+i)%workers, cluster, true)) {
+                return true;
+            }
+        }
+
+        // Sleeping until a task is pushed or the last one is done
+        unique_lock<mutex> lock(waitLock);
+        while (available == 0 && pending != 0) {
+            waiting.wait(lock);
+        }
+
+        if (pending == 0) {
+            return false;
+        }
+    }
+}
+
+void FatWorkQueue::done()
+{
+    if (--pending == 0) {
+        lock_guard<mutex> lock(waitLock);
+        waiting.notify_all();
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef _FATCAT_FATWORKQUEUE_H
+#define _FATCAT_FATWORKQUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Work-stealing queue of clusters to process, shared by a fixed number
+ * of workers
+ *
+ * Each worker pushes and pops at the front of its own deque, and steals
+ * from the back of the others' when it is empty
+ */
+class FatWorkQueue
+{
+    public:
+        FatWorkQueue(int workers);
+
+        /**
+         * Adds a task in the worker's deque
+         */
+        void push(int worker, unsigned int cluster);
+
+        /**
+         * Gets a task for the worker, waiting for one if others are
+         * still busy; returns false when everything is processed
+         */
+        bool pop(int worker, unsigned int &cluster);
+
+        /**
+         * Should be called when a task popped is processed, after
+         * its own tasks were pushed
+         */
+        void done();
+
+    protected:
+        bool take(int worker, unsigned int &cluster, bool steal);
+
+        deque<deque<unsigned int> > queues;
+        deque<mutex> locks;
+        atomic<long> pending;
+
+        // Tasks in the queues, the idle workers wait for some
+        atomic<long> available;
+        mutex waitLock;
+        condition_variable waiting;
+};
+
+#endif // _FATCAT_FATWORKQUEUE_H
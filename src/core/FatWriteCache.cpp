@@ -0,0 +1,180 @@
+#include <string.h>
+
+#include "FatSystem.h"
+#include "FatWriteCache.h"
+
+using namespace std;
+
+FatWriteCache::FatWriteCache()
+    : start(0),
+    length(0),
+    chunkSize(1),
+    sectorSize(0),
+    dirtyCount(0)
+{
+}
+
+void FatWriteCache::setArea(unsigned long long start_, unsigned long long length_,
+        unsigned long long chunkSize_, unsigned long long sectorSize_)
+{
+    start = start_;
+    length = length_;
+    chunkSize = chunkSize_ ? chunkSize_ : 1;
+    sectorSize = sectorSize_;
+    dirtyCount = 0;
+    chunks.clear();
+}
+
+char *FatWriteCache::get(FatSystem &system, unsigned long long address, int size)
+{
+    if (size <= 0 || address < start || address+size > start+length) {
+        return NULL;
+    }
+
+    unsigned long long index = (address-start)/chunkSize;
+    unsigned long long chunkStart = start+index*chunkSize;
+
+    // The sectors should not cross a chunk boundary
+    if (address+size > chunkStart+chunkSize) {
+        return NULL;
+    }
+
+    map<unsigned long long, Chunk>::iterator it = chunks.find(index);
+
+    if (it == chunks.end()) {
+        unsigned long long sectors = chunkSize;
+        if (chunkStart+sectors > start+length) {
+            sectors = start+length-chunkStart;
+        }
+
+        vector<char> data = system.readData(chunkStart, sectors);
+        it = chunks.insert(make_pair(index, Chunk())).first;
+        it->second.data.swap(data);
+        it->second.dirty.resize(sectors);
+    }
+
+    return &it->second.data[(address-chunkStart)*sectorSize];
+}
+
+const char *FatWriteCache::find(unsigned long long address, int size)
+{
+    if (chunks.empty() || size <= 0 || address < start) {
+        return NULL;
+    }
+
+    unsigned long long index = (address-start)/chunkSize;
+    unsigned long long chunkStart = start+index*chunkSize;
+    map<unsigned long long, Chunk>::iterator it = chunks.find(index);
+
+    if (it == chunks.end() || address+size > chunkStart+it->second.dirty.size()) {
+        return NULL;
+    }
+
+    return &it->second.data[(address-chunkStart)*sectorSize];
+}
+
+void FatWriteCache::markDirty(unsigned long long address, int size)
+{
+    for (unsigned long long sector=address; sector<address+size; sector++) {
+        unsigned long long index = (sector-start)/chunkSize;
+        map<unsigned long long, Chunk>::iterator it = chunks.find(index);
+
+        if (it != chunks.end()) {
+            vector<bool>::reference dirty = it->second.dirty[sector-start-index*chunkSize];
+            if (!dirty) {
+                dirty = true;
+                dirtyCount++;
+            }
+        }
+    }
+}
+
+void FatWriteCache::overlay(unsigned long long address, char *buffer, int size)
+{
+    copy(address, buffer, size, false);
+}
+
+void FatWriteCache::update(unsigned long long address, const char *buffer, int size)
+{
+    copy(address, (char *)buffer, size, true);
+}
+
+void FatWriteCache::copy(unsigned long long address, char *buffer, int size, bool toChunks)
+{
+    if (chunks.empty() || size <= 0 || address+size <= start || address >= start+length) {
+        return;
+    }
+
+    unsigned long long first = address > start ? address : start;
+    unsigned long long last = address+size < start+length ? address+size : start+length;
+    map<unsigned long long, Chunk>::iterator it = chunks.lower_bound((first-start)/chunkSize);
+
+    for (; it != chunks.end(); it++) {
+        unsigned long long chunkStart = start+it->first*chunkSize;
+        unsigned long long chunkEnd = chunkStart+it->second.dirty.size();
+        if (chunkStart >= last) {
+            break;
+        }
+
+        unsigned long long from = chunkStart > first ? chunkStart : first;
+        unsigned long long to = chunkEnd < last ? chunkEnd : last;
+        if (from >= to) {
+            continue;
+        }
+
+        char *loaded = &it->second.data[(from-chunkStart)*sectorSize];
+        char *data = buffer+(from-address)*sectorSize;
+
+        if (toChunks) {
+            // These sectors are now the same on the disk
+            if (loaded != data) {
+                memcpy(loaded, data, (to-from)*sectorSize);
+            }
+            for (unsigned long long sector=from; sector<to; sector++) {
+                vector<bool>::reference dirty = it->second.dirty[sector-chunkStart];
+                if (dirty) {
+                    dirty = false;
+                    dirtyCount--;
+                }
+            }
+        } else {
+            memcpy(data, loaded, (to-from)*sectorSize);
+        }
+    }
+}
+
+int FatWriteCache::flush(FatSystem &system)
+{
+    int writes = 0;
+    map<unsigned long long, Chunk>::iterator it;
+
+    for (it = chunks.begin(); it != chunks.end() && dirtyCount; it++) {
+        unsigned long long chunkStart = start+it->first*chunkSize;
+        vector<bool> &dirty = it->second.dirty;
+        unsigned long long sector = 0;
+
+        while (sector < dirty.size()) {
+            if (!dirty[sector]) {
+                sector++;
+                continue;
+            }
+
+            unsigned long long run = sector;
+            while (run < dirty.size() && dirty[run]) {
+                run++;
+            }
+
+            // Writing clears the dirty flags through update()
+            system.writeData(chunkStart+sector, &it->second.data[sector*sectorSize], run-sector);
+            writes++;
+            sector = run;
+        }
+    }
+
+    return writes;
+}
+
+unsigned long long FatWriteCache::dirtySectors()
+{
+    return dirtyCount;
+}
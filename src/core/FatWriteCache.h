@@ -0,0 +1,82 @@
+#ifndef _FATCAT_FATWRITECACHE_H
+#define _FATCAT_FATWRITECACHE_H
+
+#include <map>
+#include <vector>
+
+using namespace std;
+
+class FatSystem;
+
+/**
+ * Write-back copy of the FAT sectors: entries are patched in memory
+ * and the dirty sectors are written back in contiguous runs on flush
+ *
+ * The FATs area is split in chunks, loaded the first time one of
+ * their sectors is written
+ */
+class FatWriteCache
+{
+    public:
+        FatWriteCache();
+
+        /**
+         * Sets the cached area (in sectors) and the chunks size
+         */
+        void setArea(unsigned long long start, unsigned long long length,
+                unsigned long long chunkSize, unsigned long long sectorSize);
+
+        /**
+         * Returns a writable pointer to some sectors, loading their
+         * chunk if needed, or NULL if they are outside the area
+         */
+        char *get(FatSystem &system, unsigned long long address, int size);
+
+        /**
+         * Same as get(), but without loading: NULL if not loaded
+         */
+        const char *find(unsigned long long address, int size);
+
+        /**
+         * Flags some sectors as modified
+         */
+        void markDirty(unsigned long long address, int size);
+
+        /**
+         * Applies the loaded sectors to some data read from the disk
+         */
+        void overlay(unsigned long long address, char *buffer, int size);
+
+        /**
+         * Updates the loaded sectors with some data written to the disk
+         */
+        void update(unsigned long long address, const char *buffer, int size);
+
+        /**
+         * Writes the dirty sectors back, returns the number of writes
+         */
+        int flush(FatSystem &system);
+
+        unsigned long long dirtySectors();
+
+    protected:
+        struct Chunk
+        {
+            vector<char> data;
+            vector<bool> dirty;
+        };
+
+        unsigned long long start;
+        unsigned long long length;
+        unsigned long long chunkSize;
+        unsigned long long sectorSize;
+        unsigned long long dirtyCount;
+        map<unsigned long long, Chunk> chunks;
+
+        /**
+         * Copies between the loaded sectors and a buffer
+         */
+        void copy(unsigned long long address, char *buffer, int size, bool toChunks);
+};
+
+#endif // _FATCAT_FATWRITECACHE_H
@@ -13,6 +13,7 @@
 #include <analysis/FatChains.h>
 #include <analysis/FatExtract.h>
 #include <analysis/FatFix.h>
+#include <analysis/FatOwners.h>
 #include <analysis/FatSearch.h>
 
 #define ATOU(i) ((unsigned int)atoi(i))
@@ -25,28 +26,38 @@ void usage()
     cout << endl;
     cout << "Usage: fatcat disk.img [options]" << endl;
     cout << "  -i: display information about disk" << endl;
+    cout << "  -V: with -i, count the free clusters in the FAT instead of using FSInfo" << endl;
     cout << "  -O [offset]: global offset (may be partition place)" << endl;
+    cout << "  -C [size]: cache up to size MB of sectors read from the disk" << endl;
+    cout << "  -j [threads]: number of threads reading directories (-x, -k, -q, -f)" << endl;
+    cout << "  -I [file]: keep the FAT and the tree in an index file, rebuilt when outdated" << endl;
     cout << endl;
     cout << "Browsing & extracting:" << endl;
     cout << "  -l [dir]: list files and directories in the given path" << endl;
     cout << "  -L [cluster]: list files and directories in the given cluster" << endl;
     cout << "  -r [path]: reads the file given by the path" << endl;
+    cout << "  -B [file]: reads the files whose paths are listed in a file" << endl;
     cout << "  -R [cluster]: reads the data from given cluster" << endl;
     cout << "  -s [size]: specify the size of data to read from the cluster" << endl;
     cout << "  -d: enable listing of deleted files" << endl;
     cout << "  -x [directory]: extract all files to a directory, deleted files included if -d" << endl;
     cout << "                  will start with rootDirectory, unless -c is provided" << endl;
     cout << "* -S: write scamble data in unallocated sectors" << endl;
-    cout << "* -z: write scamble data in unallocated sectors" << endl;
+    cout << "* -z: write zeros in unallocated sectors" << endl;
+    cout << "* -Z: discard unallocated sectors (holes in image files, zeroed out on devices)" << endl;
     cout << endl;
     cout << "FAT Hacking" << endl;
     cout << "  -@ [cluster]: Get the cluster address and information" << endl;
     cout << "  -2: analysis & compare the 2 FATs" << endl;
+    cout << "  -D [file]: with -2, also write the differing ranges to a file" << endl;
     cout << "  -b [file]: backup the FATs (see -t)" << endl;
     cout << "* -p [file]: restore (patch) the FATs (see -t)" << endl;
     cout << "* -w [cluster] -v [value]: write next cluster (see -t)" << endl;
     cout << "  -t [table]: specify which table to write (0:both, 1:first, 2:second)" << endl;
     cout << "* -m: merge the FATs" << endl;
+    cout << "  -n: with -m, only tell what would be merged" << endl;
+    cout << "  -u [file]: with -m, save the sectors changed by the merge to a file" << endl;
+    cout << "* -U [file]: restore the sectors saved by -u" << endl;
     cout << "  -o: search for orphan files and directories" << endl;
     cout << "* -f: try to fix reachable directories" << endl;
     cout << endl;
@@ -56,6 +67,8 @@ void usage()
     cout << "* -s [size]: sets the entry size" << endl;
     cout << "* -a [attributes]: sets the entry attributes" << endl;
     cout << "  -k [cluster]: try to find an entry that point to that cluster" << endl;
+    cout << "  -q [offset]: find the entry owning the byte at the given offset" << endl;
+    cout << "  -Q [file]: same for the clusters, sectors or offsets listed in a file" << endl;
 
     cout << endl;
     cout << "*: These flags writes on the disk, and may damage it, be careful" << endl;
@@ -71,24 +84,40 @@ int main(int argc, char *argv[])
     // -O offset
     unsigned long long globalOffset = 0;
 
+    // -C: block cache size in MB
+    unsigned long long cacheSize = 0;
+
+    // -j: threads reading the directories
+    int threads = 1;
+
+    // -I: index file
+    string indexFile;
+
     // -s, specify the size to be read
-    unsigned int size = -1;
+    unsigned int size = FAT_SIZE_UNKNOWN;
 
     // -i, display information about the disk
     bool infoFlag = false;
 
+    // -V, counts the free clusters and checks the FSInfo sector
+    bool verifyFlag = false;
+
     // -l, list directories in the given path
     bool listFlag = false;
     string listPath;
 
     // -c, listing for a direct cluster
     bool listClusterFlag = false;
-    unsigned int listCluster;
+    unsigned int listCluster = 0;
 
     // -r, reads a file
     bool readFlag = false;
     string readPath;
 
+    // -B, reads the files listed in a file
+    bool readBatch = false;
+    string batchFile;
+
     // -R, reads from cluster file
     bool clusterRead = false;
     unsigned int cluster = 0;
@@ -103,6 +132,9 @@ int main(int argc, char *argv[])
     // -2: compare two fats
     bool compare = false;
 
+    // -D: file receiving the differing ranges
+    string rangesFile;
+
     // -@: get the cluster address
     bool address = false;
 
@@ -120,9 +152,16 @@ int main(int argc, char *argv[])
     // -m: merge the FATs
     bool merge = false;
 
+    // -n: dry run of the merge
+    bool dryRun = false;
+
+    // -u: file receiving the sectors changed by the merge, -U restores them
+    string rollbackFile;
+    bool rollback = false;
+
     // -v: value
     bool hasValue = false;
-    unsigned int value;
+    unsigned int value = 0;
 
     // -t: FAT table to write or read
     unsigned int table = 0;
@@ -130,6 +169,7 @@ int main(int argc, char *argv[])
     // -S: write random data in unallocated sectors
     bool scramble = false;
     bool zero = false;
+    bool discard = false;
 
     // -f: fix reachable
     bool fixReachable = false;
@@ -145,8 +185,14 @@ int main(int argc, char *argv[])
     // -k: entry finder
     bool findEntry = false;
 
+    // -q: owner of an offset, -Q: owners queries from a file
+    bool findOwner = false;
+    unsigned long long ownerOffset = 0;
+    bool ownerQueries = false;
+    string queriesFile;
+
     // Parsing command line
-    while ((index = getopt(argc, argv, "il:L:r:R:s:dc:hx:2@:ob:p:w:v:mt:Sze:O:fk:a:")) != -1) {
+    while ((index = getopt(argc, argv, "il:L:r:R:s:dc:hx:2@:ob:p:w:v:mt:Sze:O:fk:q:Q:a:C:j:I:B:VD:nu:U:Z")) != -1) {
         switch (index) {
             case 'a':
                 attributesProvided = true;
@@ -156,12 +202,29 @@ int main(int argc, char *argv[])
                 findEntry = true;
                 cluster = atoi(optarg);
                 break;
+            case 'q':
+                findOwner = true;
+                ownerOffset = atoll(optarg);
+                break;
+            case 'Q':
+                ownerQueries = true;
+                queriesFile = string(optarg);
+                break;
             case 'f':
                 fixReachable = true;
                 break;
             case 'O':
                 globalOffset = atoll(optarg);
                 break;
+            case 'C':
+                cacheSize = atoll(optarg);
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'I':
+                indexFile = string(optarg);
+                break;
             case 'e':
                 entry = true;
                 entryPath = string(optarg);
@@ -172,6 +235,9 @@ int main(int argc, char *argv[])
             case 'S':
                 scramble = true;
                 break;
+            case 'Z':
+                discard = true;
+                break;
             case 't':
                 table = ATOU(optarg);
                 break;
@@ -196,6 +262,9 @@ int main(int argc, char *argv[])
             case 'i':
                 infoFlag = true;
                 break;
+            case 'V':
+                verifyFlag = true;
+                break;
             case 'l':
                 listFlag = true;
                 listPath = string(optarg);
@@ -208,6 +277,10 @@ int main(int argc, char *argv[])
                 readFlag = true;
                 readPath = string(optarg);
                 break;
+            case 'B':
+                readBatch = true;
+                batchFile = string(optarg);
+                break;
             case 'R':
                 clusterRead = true;
                 cluster = ATOU(optarg);
@@ -230,6 +303,19 @@ int main(int argc, char *argv[])
             case '2':
                 compare = true;
                 break;
+            case 'D':
+                rangesFile = string(optarg);
+                break;
+            case 'n':
+                dryRun = true;
+                break;
+            case 'u':
+                rollbackFile = string(optarg);
+                break;
+            case 'U':
+                rollback = true;
+                rollbackFile = string(optarg);
+                break;
             case 'b':
                 backup = true;
                 backupFile = string(optarg);
@@ -260,9 +346,10 @@ int main(int argc, char *argv[])
 
     // If the user did not required any actions
     if (!(infoFlag || listFlag || listClusterFlag || 
-        readFlag || clusterRead || extract || compare || address ||
-        chains || backup || patch || writeNext || merge ||
-        scramble || zero || entry || fixReachable || findEntry)) {
+        readFlag || readBatch || clusterRead || extract || compare || address ||
+        chains || backup || patch || writeNext || merge || rollback ||
+        scramble || zero || discard || entry || fixReachable || findEntry ||
+        findOwner || ownerQueries)) {
         usage();
     }
 
@@ -271,10 +358,23 @@ int main(int argc, char *argv[])
         FatSystem fat(image, globalOffset);
 
         fat.setListDeleted(listDeleted);
+        fat.enableBlockCache(cacheSize);
 
         if (fat.init()) {
+            // The index is not built for the commands writing to the image
+            bool writing = patch || writeNext || (merge && !dryRun) || rollback
+                || scramble || zero || discard || fixReachable
+                || (entry && (clusterProvided || sizeProvided || attributesProvided));
+
+            if (indexFile != "" && !fat.index.open(fat, indexFile) && !writing) {
+                cerr << "Building the index " << indexFile << "..." << endl;
+                FatOwners owners(fat);
+                owners.setThreads(threads);
+                owners.save(indexFile);
+            }
+
             if (infoFlag) {
-                fat.infos();
+                fat.infos(verifyFlag);
             } else if (listFlag) {
                 cout << "Listing path " << listPath << endl;
                 FatPath path(listPath);
@@ -285,14 +385,17 @@ int main(int argc, char *argv[])
             } else if (readFlag) {
                 FatPath path(readPath);
                 fat.readFile(path);
+            } else if (readBatch) {
+                fat.readFiles(batchFile);
             } else if (clusterRead) {
                 fat.readFile(cluster, size);
             } else if (extract) {
                 FatExtract extract(fat);
+                extract.setThreads(threads);
                 extract.extract(cluster, extractDirectory, listDeleted);
             } else if (compare) {
                 FatDiff diff(fat);
-                diff.compare();
+                diff.compare(rangesFile);
             } else if (address) {
                 cout << "Cluster " << cluster << " address:" << endl;
                 long long addr = fat.clusterAddress(cluster);
@@ -318,10 +421,22 @@ int main(int argc, char *argv[])
                 chains.chainsAnalysis();
             } else if (fixReachable) {
                 FatFix fix(fat);
+                fix.setThreads(threads);
                 fix.fix();
             } else if (findEntry) {
                 FatSearch search(fat);
+                search.setThreads(threads);
                 search.search(cluster);
+            } else if (findOwner || ownerQueries) {
+                FatOwners owners(fat);
+                owners.setThreads(threads);
+                owners.build();
+                if (findOwner) {
+                    owners.queryOffset(ownerOffset);
+                }
+                if (ownerQueries) {
+                    owners.queryFile(queriesFile);
+                }
             } else if (backup || patch) {
                 FatBackup backupSystem(fat);
                 
@@ -347,15 +462,22 @@ int main(int argc, char *argv[])
                     printf("Writing on FAT2\n");
                     fat.writeNextCluster(cluster, value, 1);
                 } 
+                fat.flush();
             } else if (merge) {
                 FatDiff diff(fat);
-                diff.merge();
+                diff.merge(dryRun, rollbackFile);
+            } else if (rollback) {
+                FatDiff diff(fat);
+                diff.rollback(rollbackFile);
             } else if (scramble) {
                 fat.enableWrite();
-                fat.rewriteUnallocated(1);
+                fat.rewriteUnallocated(FAT_WIPE_RANDOM);
             } else if (zero) {
                 fat.enableWrite();
-                fat.rewriteUnallocated();
+                fat.rewriteUnallocated(FAT_WIPE_ZERO);
+            } else if (discard) {
+                fat.enableWrite();
+                fat.rewriteUnallocated(FAT_WIPE_DISCARD);
             } else if (entry) {
                 cout << "Searching entry for " << entryPath << endl;
                 FatPath path(entryPath);
@@ -387,7 +509,7 @@ int main(int argc, char *argv[])
                         vector<char> sector = fat.readData(entry.sector, 1);
                         entry.updateData();
                         fat.enableWrite();
-                        memcpy(&sector[entry.offset], entry.data.c_str(), entry.data.size());
+                        memcpy(&sector[entry.offset], entry.data, FAT_ENTRY_SIZE);
                         fat.writeData(entry.sector, &sector[0], 1);
                     }
                 } else {
@@ -397,6 +519,11 @@ int main(int argc, char *argv[])
         } else {
             cout << "! Failed to init the FAT filesystem" << endl;
         }
+
+        if (fat.blockCache.enabled()) {
+            cerr << "Block cache: " << fat.blockCache.hits << " hits, "
+                << fat.blockCache.misses << " misses" << endl;
+        }
     } catch (string error) {
         cerr << "Error: " << error << endl;
     }
@@ -1,6 +1,9 @@
 #include <iostream>
 #include <stdio.h>
 #include <string>
+#include <string.h>
+#include <sstream>
+#include <core/FatCodec.h>
 #include "FatDiff.h"
 
 using namespace std;
@@ -10,28 +13,33 @@ FatDiff::FatDiff(FatSystem &system)
 {
 }
 
-bool FatDiff::compare()
+bool FatDiff::compare(string rangesFile)
 {
-    bool diff = false;
-    bool mergeable = true;
+    vector<FatDiffRange> ranges;
+    unsigned long long entries = 0, conflicts = 0;
     cout << "Comparing the FATs" << endl;
 
-    for (int cluster=0; cluster<system.totalClusters; cluster++) {
-        int A = system.nextCluster(cluster, 0);
-        int B = system.nextCluster(cluster, 1);
-        if (A != B) {
-            diff = true;
-            printf("[%08x] 1:%08x 2:%08x\n", cluster, A, B);
+    bool mergeable = differences(ranges);
 
-            if (A!=0 && B!=0) {
-                mergeable = false;
-            }
+    for (vector<FatDiffRange>::iterator it = ranges.begin(); it != ranges.end(); it++) {
+        if (it->count == 1) {
+            printf("[%08x] 1:%08x 2:%08x\n", it->start, it->first, it->second);
+        } else {
+            printf("[%08x-%08x] %u entries %s\n", it->start, it->start+it->count-1,
+                    it->count, kindName(it->kind).c_str());
+        }
+
+        entries += it->count;
+        if (it->kind == FAT_DIFF_CONFLICT) {
+            conflicts += it->count;
         }
     }
  
     cout << endl;
 
-    if (diff) {
+    if (ranges.size()) {
+        cout << entries << " entries differ in " << ranges.size() << " ranges, "
+            << conflicts << " of them are used in both FATs" << endl;
         cout << "FATs differs" << endl;
         if (mergeable) {
             cout << "It seems mergeable" << endl;
@@ -42,26 +50,334 @@ bool FatDiff::compare()
         cout << "FATs are exactly equals" << endl;
     }
 
+    if (rangesFile != "") {
+        FILE *output = fopen(rangesFile.c_str(), "w");
+        if (output == NULL) {
+            ostringstream oss;
+            oss << "Unable to open file " << rangesFile << " for writing";
+            throw oss.str();
+        }
+
+        // One range per line: first cluster, number of entries, kind
+        // (FAT_DIFF_*) and the values of the first entry in each FAT
+        fprintf(output, "# start\tcount\tkind\tfirst\tsecond\n");
+        for (vector<FatDiffRange>::iterator it = ranges.begin(); it != ranges.end(); it++) {
+            fprintf(output, "%u\t%u\t%d\t%08x\t%08x\n", it->start, it->count, it->kind,
+                    it->first, it->second);
+        }
+        fclose(output);
+    }
+
+    return mergeable;
+}
+
+bool FatDiff::differences(vector<FatDiffRange> &ranges)
+{
+    ranges.clear();
+
+    if (system.bits == 12) {
+        return compareTables<12>(ranges);
+    } else if (system.bits == 16) {
+        return compareTables<16>(ranges);
+    } else {
+        return compareTables<32>(ranges);
+    }
+}
+
+string FatDiff::kindName(int kind)
+{
+    if (kind == FAT_DIFF_FIRST) {
+        return "only used in FAT 1";
+    } else if (kind == FAT_DIFF_SECOND) {
+        return "only used in FAT 2";
+    } else {
+        return "used in both FATs";
+    }
+}
+
+/**
+ * The raw tables are compared by blocks of FAT_DIFF_BLOCK entries, the
+ * entries are only decoded in the blocks that differ
+ */
+template<int Bits>
+bool FatDiff::compareTables(vector<FatDiffRange> &ranges)
+{
+    bool mergeable = true;
+    uint32_t A[FAT_DIFF_BLOCK], B[FAT_DIFF_BLOCK];
+    vector<char> bufferA, bufferB;
+    unsigned int cluster = 0;
+
+    while (true) {
+        unsigned int count = FAT_CODEC_CHUNK, countB = FAT_CODEC_CHUNK;
+        const char *dataA = FatCodec<Bits>::raw(system, 0, cluster, count, bufferA);
+        const char *dataB = FatCodec<Bits>::raw(system, 1, cluster, countB, bufferB);
+        if (dataA == NULL || dataB == NULL) {
+            break;
+        }
+
+        // The blocks have an even number of entries, so that FAT12 ones
+        // start on a byte
+        for (unsigned int i=0; i<count; i+=FAT_DIFF_BLOCK) {
+            unsigned int n = count-i < FAT_DIFF_BLOCK ? count-i : FAT_DIFF_BLOCK;
+            unsigned long long start = FatCodec<Bits>::offset(i);
+            unsigned long long bytes = FatCodec<Bits>::offset(i+n-1)+FatCodec<Bits>::size-start;
+
+            if (memcmp(dataA+start, dataB+start, bytes) == 0) {
+                continue;
+            }
+
+            FatCodec<Bits>::decode(dataA+start, A, n);
+            FatCodec<Bits>::decode(dataB+start, B, n);
+
+            for (unsigned int k=0; k<n; k++) {
+                if (A[k] == B[k]) {
+                    continue;
+                }
+
+                int kind = FAT_DIFF_CONFLICT;
+                if (B[k] == 0) {
+                    kind = FAT_DIFF_FIRST;
+                } else if (A[k] == 0) {
+                    kind = FAT_DIFF_SECOND;
+                } else {
+                    mergeable = false;
+                }
+
+                unsigned int entry = cluster+i+k;
+                if (ranges.size() && ranges.back().kind == kind
+                        && ranges.back().start+ranges.back().count == entry) {
+                    ranges.back().count++;
+                } else {
+                    FatDiffRange range(entry, 1, kind);
+                    range.first = A[k];
+                    range.second = B[k];
+                    ranges.push_back(range);
+                }
+            }
+        }
+        cluster += count;
+    }
+
     return mergeable;
 }
 
-void FatDiff::merge()
+void FatDiff::merge(bool dryRun, string rollbackFile)
 {
-    int merged = 0;
+    vector<FatDiffRange> ranges;
     cout << "Beginning the merge..." << endl;
+
+    differences(ranges);
+
+    if (system.bits == 12) {
+        mergeTables<12>(ranges, dryRun, rollbackFile);
+    } else if (system.bits == 16) {
+        mergeTables<16>(ranges, dryRun, rollbackFile);
+    } else {
+        mergeTables<32>(ranges, dryRun, rollbackFile);
+    }
+}
+
+/**
+ * The raw entries are copied through the FAT write cache, the changed
+ * sectors being written back in contiguous runs by flush()
+ */
+template<int Bits>
+void FatDiff::mergeTables(vector<FatDiffRange> &ranges, bool dryRun, string rollbackFile)
+{
+    vector<pair<unsigned long long, unsigned long long> > runs[2];
+    unsigned long long merged = 0, conflicts = 0, sectors = 0;
+    const char *verb = dryRun ? "Would merge" : "Merging";
+
+    // Sectors of each FAT changed by the merge
+    for (vector<FatDiffRange>::iterator it = ranges.begin(); it != ranges.end(); it++) {
+        if (it->kind == FAT_DIFF_CONFLICT) {
+            conflicts += it->count;
+            continue;
+        }
+
+        if (it->count == 1) {
+            printf("%s cluster %u\n", verb, it->start);
+        } else {
+            printf("%s clusters %u to %u\n", verb, it->start, it->start+it->count-1);
+        }
+        merged += it->count;
+
+        int fat = it->kind == FAT_DIFF_FIRST ? 1 : 0;
+        unsigned long long table = system.fatStart+system.sectorsPerFat*fat;
+        unsigned long long first = table+FatCodec<Bits>::offset(it->start)/system.bytesPerSector;
+        unsigned long long end = table+(FatCodec<Bits>::offset(it->start+it->count-1)
+                +FatCodec<Bits>::size+system.bytesPerSector-1)/system.bytesPerSector;
+
+        vector<pair<unsigned long long, unsigned long long> > &fatRuns = runs[fat];
+        if (fatRuns.size() && first <= fatRuns.back().first+fatRuns.back().second) {
+            unsigned long long last = fatRuns.back().first+fatRuns.back().second;
+            if (end > last) {
+                fatRuns.back().second += end-last;
+                sectors += end-last;
+            }
+        } else {
+            fatRuns.push_back(pair<unsigned long long, unsigned long long>(first, end-first));
+            sectors += end-first;
+        }
+    }
+
+    if (conflicts) {
+        cout << conflicts << " entries used in both FATs are left as they are" << endl;
+    }
+
+    if (dryRun) {
+        cout << "Dry run, " << merged << " clusters would be merged, changing "
+            << runs[0].size()+runs[1].size() << " runs of sectors ("
+            << sectors << " sectors)" << endl;
+        return;
+    }
+
+    if (merged == 0) {
+        cout << "Merge complete, 0 clusters merged" << endl;
+        return;
+    }
+
+    if (rollbackFile != "") {
+        runs[0].insert(runs[0].end(), runs[1].begin(), runs[1].end());
+        saveSectors(rollbackFile, runs[0]);
+        cout << "Saved " << sectors << " sectors to " << rollbackFile << endl;
+    }
+
     system.enableWrite();
 
-    for (int cluster=0; cluster<system.totalClusters; cluster++) {
-        int A = system.nextCluster(cluster, 0);
-        int B = system.nextCluster(cluster, 1);
+    vector<char> buffer;
+    for (vector<FatDiffRange>::iterator it = ranges.begin(); it != ranges.end(); it++) {
+        if (it->kind == FAT_DIFF_CONFLICT) {
+            continue;
+        }
+
+        int source = it->kind == FAT_DIFF_FIRST ? 0 : 1;
+        unsigned int end = it->start+it->count;
+        for (unsigned int cluster=it->start; cluster<end; ) {
+            unsigned int count = end-cluster < FAT_CODEC_CHUNK ? end-cluster : FAT_CODEC_CHUNK;
+            const char *data = FatCodec<Bits>::raw(system, source, cluster, count, buffer);
+            if (data == NULL) {
+                throw string("Unable to read the FAT");
+            }
+
+            // The raw values are copied, keeping the reserved bits
+            unsigned long long base = FatCodec<Bits>::offset(cluster);
+            for (unsigned int k=0; k<count; k++) {
+                const char *entry = data+(FatCodec<Bits>::offset(cluster+k)-base);
+                system.writeNextCluster(cluster+k, FatCodec<Bits>::get(entry, cluster+k), 1-source);
+            }
+            cluster += count;
+        }
+    }
+
+    int writes = system.flush();
+    cout << "Merge complete, " << merged << " clusters merged, "
+        << sectors << " sectors written in " << writes << " writes" << endl;
+}
+
+void FatDiff::saveSectors(string rollbackFile, vector<pair<unsigned long long, unsigned long long> > &runs)
+{
+    FILE *output = fopen(rollbackFile.c_str(), "wb");
+    if (output == NULL) {
+        ostringstream oss;
+        oss << "Unable to open file " << rollbackFile << " for writing";
+        throw oss.str();
+    }
+
+    char header[FAT_ROLLBACK_HEADER];
+    rollbackHeader(header);
+    bool ok = fwrite(header, sizeof(header), 1, output) == 1;
+
+    vector<char> buffer;
+    for (unsigned int i=0; ok && i<runs.size(); i++) {
+        for (unsigned long long done=0; ok && done<runs[i].second; ) {
+            unsigned long long count = runs[i].second-done;
+            if (count > FAT_READ_AHEAD) {
+                count = FAT_READ_AHEAD;
+            }
+
+            char run[12];
+            FAT_WRITE_LONG(run, 0, (runs[i].first+done)&0xffffffff);
+            FAT_WRITE_LONG(run, 4, (runs[i].first+done)>>32);
+            FAT_WRITE_LONG(run, 8, count);
+
+            const char *data = system.readData(runs[i].first+done, count, buffer);
+            ok = data != NULL && fwrite(run, sizeof(run), 1, output) == 1
+                && fwrite(data, count*system.bytesPerSector, 1, output) == 1;
+            done += count;
+        }
+    }
+
+    // Nothing is merged if the sectors can't be saved
+    if (fclose(output) != 0 || !ok) {
+        ostringstream oss;
+        oss << "Unable to save the sectors to " << rollbackFile << ", nothing merged";
+        throw oss.str();
+    }
+}
+
+void FatDiff::rollbackHeader(char *header)
+{
+    unsigned long long identity[] = {
+        system.fatStart, system.sectorsPerFat, system.totalSectors, system.globalOffset
+    };
+
+    memcpy(header, FAT_ROLLBACK_MAGIC, 8);
+    FAT_WRITE_LONG(header, 8, system.bytesPerSector);
+    FAT_WRITE_LONG(header, 12, system.diskId);
+    for (int i=0; i<4; i++) {
+        FAT_WRITE_LONG(header, 16+8*i, identity[i]&0xffffffff);
+        FAT_WRITE_LONG(header, 20+8*i, identity[i]>>32);
+    }
+}
+
+void FatDiff::rollback(string rollbackFile)
+{
+    FILE *input = fopen(rollbackFile.c_str(), "rb");
+    if (input == NULL) {
+        ostringstream oss;
+        oss << "Unable to open file " << rollbackFile << " for reading";
+        throw oss.str();
+    }
+
+    // The file must come from this very system, nothing is written
+    // otherwise
+    char header[FAT_ROLLBACK_HEADER], expected[FAT_ROLLBACK_HEADER];
+    rollbackHeader(expected);
+    if (fread(header, sizeof(header), 1, input) != 1
+            || memcmp(header, expected, sizeof(header)) != 0) {
+        fclose(input);
+        throw string("This file doesn't contain sectors saved by a merge of this system");
+    }
+
+    system.enableWrite();
+
+    unsigned long long sectors = 0;
+    char run[12];
+    vector<char> buffer;
+    while (fread(run, sizeof(run), 1, input) == 1) {
+        uint32_t low = FAT_READ_LONG(run, 0);
+        uint32_t high = FAT_READ_LONG(run, 4);
+        unsigned long long first = low|((unsigned long long)high<<32);
+        unsigned int count = FAT_READ_LONG(run, 8);
+
+        // Only the FATs are restored
+        if (count > FAT_READ_AHEAD || first < system.fatStart
+                || first+count > system.fatStart+system.fats*system.sectorsPerFat) {
+            cerr << "! Skipping invalid run of sectors at " << first << endl;
+            break;
+        }
 
-        if (A != B && (A==0 || B==0)) {
-            printf("Merging cluster %d\n", cluster);
-            system.writeNextCluster(cluster, A+B, 0);
-            system.writeNextCluster(cluster, A+B, 1);
-            merged++;
+        buffer.resize(count*system.bytesPerSector);
+        if (fread(&buffer[0], buffer.size(), 1, input) != 1) {
+            cerr << "! The file is truncated" << endl;
+            break;
         }
+        system.writeData(first, &buffer[0], count);
+        sectors += count;
     }
 
-    cout << "Merge complete, " << merged << " clusters merged" << endl;
+    fclose(input);
+    system.flush();
+    cout << "Rollback complete, " << sectors << " sectors restored" << endl;
 }
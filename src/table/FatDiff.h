@@ -1,22 +1,99 @@
 #ifndef _FATCAT_FATDIFF_H
 #define _FATCAT_FATDIFF_H
 
+#include <stdint.h>
+#include <string>
+#include <vector>
 #include <core/FatModule.h>
 
+using namespace std;
+
+// Ways an entry can differ between the 2 FATs
+#define FAT_DIFF_FIRST      1   // Only used in the first FAT
+#define FAT_DIFF_SECOND     2   // Only used in the second FAT
+#define FAT_DIFF_CONFLICT   3   // Used in both FATs, with different values
+
+// Number of entries compared at once, as raw bytes, before decoding them
+#define FAT_DIFF_BLOCK      256
+
+// Sectors saved before a merge: this magic, the sector size and the volume
+// id (32 bits), the FAT start, the sectors per FAT, the total sectors and
+// the offset of the system (64 bits each), then runs of a first sector
+// (64 bits), a number of sectors (32 bits) and their data
+#define FAT_ROLLBACK_MAGIC  "FATCATRB"
+#define FAT_ROLLBACK_HEADER 48
+
+/**
+ * A run of entries differing the same way between the 2 FATs
+ */
+class FatDiffRange
+{
+    public:
+        FatDiffRange(unsigned int start = 0, unsigned int count = 0, int kind = 0)
+            : start(start), count(count), kind(kind), first(0), second(0)
+        {
+        }
+
+        unsigned int start;
+        unsigned int count;
+        int kind;
+
+        // Values of the first entry in each FAT
+        uint32_t first;
+        uint32_t second;
+};
+
 class FatDiff : public FatModule
 {
     public:
         FatDiff(FatSystem &system);
 
         /**
-         * Compare the 2 FATs
+         * Compare the 2 FATs, the differing ranges are also written to
+         * the given file if any
+         */
+        bool compare(string rangesFile = "");
+
+        /**
+         * Merge the 2 FATs, the entries used in only one of them being
+         * copied to the other; with dryRun, only tells what would be
+         * changed; the sectors to change are first saved to rollbackFile
+         * if any
+         */
+        void merge(bool dryRun = false, string rollbackFile = "");
+
+        /**
+         * Writes back the sectors saved before a merge
+         */
+        void rollback(string rollbackFile);
+
+        /**
+         * Runs of differing entries, returns true if they can be merged
+         */
+        bool differences(vector<FatDiffRange> &ranges);
+
+    protected:
+        template<int Bits>
+        bool compareTables(vector<FatDiffRange> &ranges);
+
+        template<int Bits>
+        void mergeTables(vector<FatDiffRange> &ranges, bool dryRun, string rollbackFile);
+
+        /**
+         * Saves the given runs of sectors (first, count)
+         */
+        void saveSectors(string rollbackFile, vector<pair<unsigned long long, unsigned long long> > &runs);
+
+        /**
+         * Header of the sectors saved from this system, a rollback is
+         * only done if it matches
          */
-        bool compare();
+        void rollbackHeader(char *header);
 
         /**
-         * Merge the 2 FATs
+         * Name of a kind of difference
          */
-        void merge();
+        static string kindName(int kind);
 };
 
 #endif // _FATCAT_FATDIFF_H
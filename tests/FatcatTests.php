@@ -5,6 +5,19 @@
  */
 class FatcatTests extends \PHPUnit_Framework_TestCase
 {
+    /**
+     * Contents of the files of fat12.img and fat16.img
+     */
+    protected function imageFile($index, $size)
+    {
+        $data = '';
+        for ($line=1; strlen($data)<$size; $line++) {
+            $data .= "Line $line of file $index\n";
+        }
+
+        return substr($data, 0, $size);
+    }
+
     /**
      * Testing that the usage appears
      */
@@ -30,10 +43,54 @@ class FatcatTests extends \PHPUnit_Framework_TestCase
         $this->assertContains('mkdosfs', $infos);
         $this->assertContains('Bytes per cluster: 512', $infos);
         $this->assertContains('Fat size: 403456', $infos);
-        $this->assertContains('Data size: 51642368', $infos);
+        $this->assertContains('Total data clusters: 100792', $infos);
+        $this->assertContains('Data size: 51605504', $infos);
         $this->assertContains('Disk size: 52428800', $infos);
     }
 
+    /**
+     * Testing the free clusters count of the FSInfo sector
+     */
+    public function testFsInfo()
+    {
+        $infos = `fatcat /tmp/empty.img -i`;
+        $this->assertContains('Free clusters (FSInfo)', $infos);
+
+        $infos = `fatcat /tmp/empty.img -i -V`;
+        $this->assertContains('matches the FAT', $infos);
+
+        // The FSInfo sector is the sector 1, its free count at 0x1e8
+        copy('/tmp/hello-world.img', '/tmp/fsinfo.img');
+        $image = fopen('/tmp/fsinfo.img', 'r+b');
+        fseek($image, 512+0x1e8);
+        fwrite($image, pack('V', 5));
+        fclose($image);
+
+        $infos = `fatcat /tmp/fsinfo.img -i`;
+        $this->assertContains('Free clusters (FSInfo): 5/', $infos);
+
+        $infos = `fatcat /tmp/fsinfo.img -i -V`;
+        $this->assertContains('FSInfo free clusters: 5 (MISMATCH', $infos);
+
+        // Without FSInfo, both counts are the ones of the data area
+        $infos = `fatcat /tmp/fat16.img -i`;
+        $this->assertContains('Free clusters: 10191/10211', $infos);
+        $this->assertContains('Data size: 20912128', $infos);
+        $infos = `fatcat /tmp/fat16.img -i -V`;
+        $this->assertContains('Free clusters: 10191/10211', $infos);
+        $infos = `fatcat /tmp/fat12.img -i -V`;
+        $this->assertContains('Free clusters: 2825/2845', $infos);
+
+        // The count of the FAT sees the clusters allocated after the
+        // FSInfo sector was written
+        copy('/tmp/hello-world.img', '/tmp/fsinfo.img');
+        `fatcat /tmp/fsinfo.img -w 100 -v 101`;
+        `fatcat /tmp/fsinfo.img -w 101 -v 268435455`;
+        $infos = `fatcat /tmp/fsinfo.img -i -V`;
+        $this->assertContains('Free clusters: 100786/100792', $infos);
+        $this->assertContains('FSInfo free clusters: 100788 (MISMATCH, the FAT has 100786)', $infos);
+    }
+
     /**
      * Testing listing a directory
      */
@@ -48,6 +105,20 @@ class FatcatTests extends \PHPUnit_Framework_TestCase
 
         $listing = `fatcat /tmp/hello-world.img -l /xyz 2>&1`;
         $this->assertContains('Error', $listing);
+
+        // Short, long and deleted entries in the root directory of FAT12
+        // and FAT16
+        foreach (array('fat12', 'fat16') as $image) {
+            $listing = `fatcat /tmp/$image.img -l /`;
+            $this->assertContains('FILE0.TXT', $listing);
+            $this->assertContains('FILE4.TXT', $listing);
+            $this->assertContains('a long file name.txt', $listing);
+            $this->assertNotContains('ALONG~1.TXT', $listing);
+            $this->assertNotContains('GONE.TXT', $listing);
+
+            $listing = `fatcat /tmp/$image.img -l / -d`;
+            $this->assertContains('GONE.TXT', $listing);
+        }
     }
 
     /**
@@ -66,6 +137,316 @@ class FatcatTests extends \PHPUnit_Framework_TestCase
 
         $file = `fatcat /tmp/hello-world.img -R 5 -s 29`;
         $this->assertEquals("Hello!\nThis is another file!\n", $file);
+
+        file_put_contents('/tmp/paths.txt', "/hello.txt\n/FILES/other_file.txt\n/hello.txt\n");
+        $files = `fatcat /tmp/hello-world.img -B /tmp/paths.txt`;
+        $this->assertEquals("Hello world!\nHello!\nThis is another file!\nHello world!\n", $files);
+
+        // The names are folded once in the cached directories, a missing
+        // one doesn't stop the batch
+        file_put_contents('/tmp/paths.txt', "/FILES/OTHER_FILE.TXT\n/files/missing.txt\n/Hello.Txt\n");
+        $files = `fatcat /tmp/hello-world.img -B /tmp/paths.txt 2>&1`;
+        $this->assertEquals("Hello!\nThis is another file!\n! File not found\nHello world!\n", $files);
+
+        $file = `fatcat /tmp/fat16.img -r '/A LONG FILE NAME.TXT'`;
+        $this->assertEquals($this->imageFile(2, 6351), $file);
+
+        // Runs of sectors spanning several clusters
+        $file = `fatcat /tmp/fat12.img -R 24 -s 2967`;
+        $this->assertEquals($this->imageFile(4, 2967), $file);
+
+        $file = `fatcat /tmp/fat16.img -R 24 -s 10647`;
+        $this->assertEquals($this->imageFile(4, 10647), $file);
+
+        $image = __DIR__ . '/../docs/images/fat16.img.gz';
+        $file = `fatcat $image -r /FILE4.TXT 2>/dev/null`;
+        $this->assertEquals($this->imageFile(4, 10647), $file);
+    }
+
+    /**
+     * Testing reading fragmented and contiguous files, FILE1.TXT and
+     * FILE3.TXT having a free cluster between each of theirs
+     */
+    public function testReadingChains()
+    {
+        $sizes = array(
+            'fat12' => array(519, 1131, 1743, 2355, 2967),
+            'fat16' => array(2055, 4203, 6351, 8499, 10647)
+        );
+
+        foreach ($sizes as $image => $size) {
+            foreach (array(0, 1, 3, 4) as $index) {
+                $file = `fatcat /tmp/$image.img -r /FILE$index.TXT`;
+                $this->assertEquals($this->imageFile($index, $size[$index]), $file);
+            }
+
+            $file = `fatcat /tmp/$image.img -r "/a long file name.txt"`;
+            $this->assertEquals($this->imageFile(2, $size[2]), $file);
+        }
+    }
+
+    /**
+     * Testing that the mapped raw images read as the compressed ones, which
+     * go through the driver
+     */
+    public function testMapping()
+    {
+        $image = __DIR__ . '/../docs/images/hello-world.img.gz';
+        $this->assertEquals(`fatcat $image -l /files/ 2>&1`, `fatcat /tmp/hello-world.img -l /files/ 2>&1`);
+        $this->assertEquals(`fatcat $image -r /files/other_file.txt`, `fatcat /tmp/hello-world.img -r /files/other_file.txt`);
+
+        // The offset is not on a page boundary of the mapping
+        file_put_contents('/tmp/shifted.img', str_repeat("\x00", 512) . file_get_contents('/tmp/hello-world.img'));
+        $file = `fatcat /tmp/shifted.img -O 512 -r /hello.txt`;
+        $this->assertEquals("Hello world!\n", $file);
+
+        `rm -rf /tmp/shifted-extract`;
+        `mkdir /tmp/shifted-extract`;
+        `fatcat /tmp/shifted.img -O 512 -x /tmp/shifted-extract`;
+        $this->assertEquals("Hello!\nThis is another file!\n", file_get_contents('/tmp/shifted-extract/files/other_file.txt'));
+    }
+
+    /**
+     * Testing opening the partitions of a whole disk image with -O
+     */
+    public function testOffset()
+    {
+        $listing = `fatcat /tmp/partitions.img -O 1048576 -l /`;
+        $this->assertContains('hello.txt', $listing);
+        $this->assertContains('files/', $listing);
+
+        $file = `fatcat /tmp/partitions.img -O 1048576 -r /files/other_file.txt`;
+        $this->assertEquals("Hello!\nThis is another file!\n", $file);
+
+        $infos = `fatcat /tmp/partitions.img -O 53477376 -i`;
+        $this->assertContains('mkdosfs', $infos);
+        $this->assertContains('Disk size: 52428800', $infos);
+
+        $listing = `fatcat /tmp/partitions.img -O 53477376 -l /`;
+        $this->assertNotContains('hello.txt', $listing);
+
+        // Writing to the second partition leaves the first one untouched
+        copy('/tmp/partitions.img', '/tmp/partitions-write.img');
+        `fatcat /tmp/partitions-write.img -O 53477376 -w 100 -v 5 -t 2`;
+
+        $diff = `fatcat /tmp/partitions-write.img -O 53477376 -2`;
+        $this->assertContains('[00000064] 1:00000000 2:00000005', $diff);
+
+        $diff = `fatcat /tmp/partitions-write.img -O 1048576 -2`;
+        $this->assertContains('FATs are exactly equals', $diff);
+    }
+
+    /**
+     * Testing a partition located after 2TB in a sparse disk
+     */
+    public function testBigDisk()
+    {
+        $offset = 2199024304128;
+
+        $listing = `fatcat /tmp/big-disk.img -O $offset -l /`;
+        $this->assertContains('hello.txt', $listing);
+
+        $file = `fatcat /tmp/big-disk.img -O $offset -r /files/other_file.txt`;
+        $this->assertEquals("Hello!\nThis is another file!\n", $file);
+
+        $file = `fatcat /tmp/big-disk.img -O $offset -R 3 -s 13`;
+        $this->assertEquals("Hello world!\n", $file);
+    }
+
+    /**
+     * Testing reading with the block cache enabled
+     */
+    public function testBlockCache()
+    {
+        $file = `fatcat /tmp/hello-world.img -C 4 -r /files/other_file.txt 2>/dev/null`;
+        $this->assertEquals("Hello!\nThis is another file!\n", $file);
+
+        // The mapped images don't use it
+        $listing = `fatcat /tmp/deleted.img -C 4 -l /deleted -d 2>&1`;
+        $this->assertContains('file.txt', $listing);
+        $this->assertNotContains('Block cache:', $listing);
+
+        $image = __DIR__ . '/../docs/images/deleted.img.gz';
+        $listing = `fatcat $image -C 4 -l /deleted -d 2>&1`;
+        $this->assertContains('file.txt', $listing);
+        $this->assertContains('Block cache:', $listing);
+    }
+
+    /**
+     * Testing walking the directories with several threads
+     */
+    public function testThreads()
+    {
+        $search = `fatcat /tmp/hello-world.img -k 5 -j 4`;
+        $this->assertContains('Found /files/other_file.txt in directory files (4)', $search);
+
+        // Through the driver and the block cache
+        $image = __DIR__ . '/../docs/images/hello-world.img.gz';
+        $search = `fatcat $image -k 5 -j 4 -C 1 2>/dev/null`;
+        $this->assertContains('Found /files/other_file.txt in directory files (4)', $search);
+
+        `rm -rf /tmp/hello-world-threads`;
+        `mkdir /tmp/hello-world-threads`;
+        `fatcat /tmp/hello-world.img -x /tmp/hello-world-threads -j 4`;
+        $file = file_get_contents('/tmp/hello-world-threads/files/other_file.txt');
+        $this->assertEquals("Hello!\nThis is another file!\n", $file);
+    }
+
+    /**
+     * Testing extracting files, the contiguous runs of clusters being
+     * copied from the image to the files directly
+     */
+    public function testExtract()
+    {
+        `rm -rf /tmp/fat16-extract`;
+        `mkdir /tmp/fat16-extract`;
+        `fatcat /tmp/fat16.img -x /tmp/fat16-extract -d 2>/dev/null`;
+
+        $sizes = array(2055, 4203, 6351, 8499, 10647);
+        foreach (array(0, 1, 3, 4) as $index) {
+            $file = file_get_contents("/tmp/fat16-extract/FILE$index.TXT");
+            $this->assertEquals($this->imageFile($index, $sizes[$index]), $file);
+        }
+
+        $file = file_get_contents('/tmp/fat16-extract/a long file name.txt');
+        $this->assertEquals($this->imageFile(2, $sizes[2]), $file);
+
+        $file = file_get_contents('/tmp/fat16-extract/GONE.TXT');
+        $this->assertEquals("This file was deleted!\n", $file);
+
+        // The extracted files are the ones read with -r
+        `rm -rf /tmp/hello-world-extract`;
+        `mkdir /tmp/hello-world-extract`;
+        `fatcat /tmp/hello-world.img -x /tmp/hello-world-extract`;
+        $file = file_get_contents('/tmp/hello-world-extract/hello.txt');
+        $this->assertEquals(`fatcat /tmp/hello-world.img -r /hello.txt`, $file);
+    }
+
+    /**
+     * Testing the owners of clusters, sectors and offsets
+     */
+    public function testOwners()
+    {
+        $owner = `fatcat /tmp/hello-world.img -q 823808`;
+        $this->assertContains('(sector 1609, cluster 3): /hello.txt', $owner);
+
+        file_put_contents('/tmp/queries.txt', "cluster 5\nsector 0\n");
+        $owners = `fatcat /tmp/hello-world.img -Q /tmp/queries.txt`;
+        $this->assertContains('Cluster 5: /files/other_file.txt', $owners);
+        $this->assertContains('Sector 0: reserved sectors', $owners);
+
+        // Through the FAT cache, decoded from 12 and 16 bits entries
+        file_put_contents('/tmp/queries.txt', "cluster 18\ncluster 17\ncluster 29\n");
+        foreach (array('fat12', 'fat16') as $image) {
+            $owners = `fatcat /tmp/$image.img -Q /tmp/queries.txt`;
+            $this->assertContains('Cluster 18: /FILE3.TXT', $owners);
+            $this->assertContains('Cluster 17: free', $owners);
+            $this->assertContains('Cluster 29: /FILE4.TXT', $owners);
+        }
+    }
+
+    /**
+     * Testing the index file
+     */
+    public function testIndex()
+    {
+        @unlink('/tmp/hello-world.fatidx');
+
+        $listing = `fatcat /tmp/hello-world.img -I /tmp/hello-world.fatidx -l / 2>&1`;
+        $this->assertContains('Building the index', $listing);
+        $this->assertContains('hello.txt', $listing);
+        $this->assertTrue(file_exists('/tmp/hello-world.fatidx'));
+
+        $listing = `fatcat /tmp/hello-world.img -I /tmp/hello-world.fatidx -l /files/ 2>&1`;
+        $this->assertNotContains('Building the index', $listing);
+        $this->assertContains('other_file.txt', $listing);
+
+        $file = `fatcat /tmp/hello-world.img -I /tmp/hello-world.fatidx -r /hello.txt`;
+        $this->assertEquals("Hello world!\n", $file);
+
+        $owner = `fatcat /tmp/hello-world.img -I /tmp/hello-world.fatidx -q 823808`;
+        $this->assertContains('(sector 1609, cluster 3): /hello.txt', $owner);
+
+        // -k finds the entries in the index as while walking the tree
+        $search = `fatcat /tmp/hello-world.img -I /tmp/hello-world.fatidx -k 5`;
+        $this->assertContains('Found /files/other_file.txt in directory files (4)', $search);
+        $this->assertEquals(`fatcat /tmp/hello-world.img -k 5`, $search);
+
+        // Writing to the image keeps the index file, it is not built
+        // for the writes
+        $write = `fatcat /tmp/hello-world.img -I /tmp/hello-world.fatidx -w 100 -v 0 -t 2 2>&1`;
+        $this->assertNotContains('Building the index', $write);
+        $this->assertTrue(file_exists('/tmp/hello-world.fatidx'));
+
+        // But it no longer matches the image, and is rebuilt
+        $listing = `fatcat /tmp/hello-world.img -I /tmp/hello-world.fatidx -l / 2>&1`;
+        $this->assertContains('Building the index', $listing);
+        $this->assertContains('hello.txt', $listing);
+        @unlink('/tmp/hello-world.fatidx');
+    }
+
+    /**
+     * Testing a file whose chain loops
+     */
+    public function testLoop()
+    {
+        $infos = `fatcat /tmp/infinite-file.img -@ 35 2>&1`;
+        $this->assertContains('Loop detected, 39 points to 35', $infos);
+        $this->assertContains('Chain size: 5', $infos);
+
+        $file = `fatcat /tmp/infinite-file.img -r /BigMamma 2>/dev/null`;
+        $this->assertEquals(2560, strlen($file));
+
+        $chains = `fatcat /tmp/infinite-file.img -o 2>&1`;
+        $this->assertContains('Found 3 chains', $chains);
+        $this->assertContains('File clusters 40 to 56', $chains);
+    }
+
+    /**
+     * Testing the chains of FAT12 and FAT16 images, whose reserved entries
+     * are not chains
+     */
+    public function testChains()
+    {
+        foreach (array('fat12', 'fat16') as $image) {
+            $chains = `fatcat /tmp/$image.img -o 2>&1`;
+            $this->assertContains('Found 5 chains', $chains);
+            $this->assertContains('There is no orphaned chains', $chains);
+            $this->assertNotContains('Error', $chains);
+        }
+
+        // Two chains joining at cluster 222, and a loop of two clusters
+        copy('/tmp/fat16.img', '/tmp/fat16-chains.img');
+        $entries = array(200 => 201, 201 => 200, 220 => 222, 221 => 222, 222 => 223, 223 => 65535);
+        foreach ($entries as $cluster => $next) {
+            `fatcat /tmp/fat16-chains.img -w $cluster -v $next`;
+        }
+
+        $chains = `fatcat /tmp/fat16-chains.img -o 2>&1`;
+        $this->assertContains('Found 8 chains', $chains);
+        $this->assertContains('File clusters 220 to 223: ~6K', $chains);
+        $this->assertContains('File clusters 221 to 223: ~6K', $chains);
+        $this->assertContains('File clusters 200 to 201: ~4K', $chains);
+    }
+
+    /**
+     * Testing finding the orphaned directories and files
+     */
+    public function testOrphans()
+    {
+        $orphans = `fatcat /tmp/repair.img -o 2>&1`;
+        $this->assertContains('There is 2 orphaned elements', $orphans);
+        $this->assertContains('Directory clusters 33 to 33: 2 elements', $orphans);
+        $this->assertContains('File clusters 42 to 42', $orphans);
+        $this->assertContains('orphan_file.txt', $orphans);
+
+        // A chain that no directory points to
+        `cp /tmp/fat16.img /tmp/fat16-orphan.img`;
+        `fatcat /tmp/fat16-orphan.img -w 100 -v 101`;
+        `fatcat /tmp/fat16-orphan.img -w 101 -v 65535`;
+        $orphans = `fatcat /tmp/fat16-orphan.img -o 2>&1`;
+        $this->assertContains('There is 1 orphaned elements', $orphans);
+        $this->assertContains('File clusters 100 to 101', $orphans);
     }
 
     /**
@@ -76,15 +457,167 @@ class FatcatTests extends \PHPUnit_Framework_TestCase
         $diff = `fatcat /tmp/hello-world.img -2`;
         $this->assertContains('FATs are exactly equals', $diff);
 
-        $diff = `fatcat /tmp/repair.img -2`;
+        $diff = `fatcat /tmp/repair.img -2 -D /tmp/repair.diff`;
         $this->assertContains('FATs differs', $diff);
         $this->assertContains('It seems mergeable', $diff);
+        $this->assertContains('1 entries differ in 1 ranges, 0 of them are used in both FATs', $diff);
+        $ranges = file_get_contents('/tmp/repair.diff');
+        $this->assertContains("# start\tcount\tkind\tfirst\tsecond\n", $ranges);
+        $this->assertContains("32\t1\t2\t00000000\tffffffff\n", $ranges);
+
+        // Ranges of entries and entries used in both FATs
+        `cp /tmp/fat16.img /tmp/fat16-diff.img`;
+        `fatcat /tmp/fat16-diff.img -w 100 -v 2748 -t 2`;
+        `fatcat /tmp/fat16-diff.img -w 101 -v 291 -t 2`;
+        `fatcat /tmp/fat16-diff.img -w 14 -v 17 -t 1`;
+        $diff = `fatcat /tmp/fat16-diff.img -2 -D /tmp/fat16.diff`;
+        $this->assertContains('[0000000e] 1:00000011 2:00000010', $diff);
+        $this->assertContains('[00000064-00000065] 2 entries only used in FAT 2', $diff);
+        $this->assertContains('3 entries differ in 2 ranges, 1 of them are used in both FATs', $diff);
+        $this->assertContains("It doesn't seems mergeable", $diff);
+        $ranges = file_get_contents('/tmp/fat16.diff');
+        $this->assertContains("14\t1\t3\t00000011\t00000010\n", $ranges);
+        $this->assertContains("100\t2\t2\t00000000\t00000abc\n", $ranges);
         
-        $merge = `fatcat /tmp/repair.img -m`;
+        $merge = `fatcat /tmp/repair.img -m -n`;
+        $this->assertContains('Would merge cluster 32', $merge);
+        $this->assertContains('Dry run, 1 clusters would be merged', $merge);
+
+        $diff = `fatcat /tmp/repair.img -2`;
+        $this->assertContains('FATs differs', $diff);
+
+        $merge = `fatcat /tmp/repair.img -m -u /tmp/repair.rollback`;
         $this->assertContains('Merging cluster 32', $merge);
 
         $diff = `fatcat /tmp/repair.img -2`;
         $this->assertContains('FATs are exactly equals', $diff);
+
+        // The saved sectors can't be written back to another system
+        $rollback = `fatcat /tmp/hello-world.img -U /tmp/repair.rollback 2>&1`;
+        $this->assertContains("doesn't contain sectors saved by a merge of this system", $rollback);
+        $diff = `fatcat /tmp/hello-world.img -2`;
+        $this->assertContains('FATs are exactly equals', $diff);
+
+        // Undoing the merge
+        $rollback = `fatcat /tmp/repair.img -U /tmp/repair.rollback`;
+        $this->assertContains('Rollback complete, 1 sectors restored', $rollback);
+
+        $diff = `fatcat /tmp/repair.img -2`;
+        $this->assertContains('[00000020] 1:00000000 2:ffffffff', $diff);
+    }
+
+    /**
+     * Testing writing a next cluster value on only one of the FATs
+     */
+    public function testWriteNext()
+    {
+        `fatcat /tmp/hello-world.img -w 100 -v 5 -t 2`;
+
+        $diff = `fatcat /tmp/hello-world.img -2`;
+        $this->assertContains('[00000064] 1:00000000 2:00000005', $diff);
+
+        `fatcat /tmp/hello-world.img -w 100 -v 0 -t 2`;
+
+        $diff = `fatcat /tmp/hello-world.img -2`;
+        $this->assertContains('FATs are exactly equals', $diff);
+
+        // Without -t, the buffered entries are flushed to both FATs
+        copy('/tmp/hello-world.img', '/tmp/write-next.img');
+        `fatcat /tmp/write-next.img -w 100 -v 101`;
+        `fatcat /tmp/write-next.img -w 101 -v 268435455`;
+
+        $diff = `fatcat /tmp/write-next.img -2`;
+        $this->assertContains('FATs are exactly equals', $diff);
+
+        $infos = `fatcat /tmp/write-next.img -@ 100`;
+        $this->assertContains('FAT1: 101', $infos);
+        $this->assertContains('FAT2: 101', $infos);
+        $this->assertContains('Chain size: 2', $infos);
+
+        // 12 and 16 bits entries, the FAT12 entry of cluster 341 being
+        // across 2 sectors
+        foreach (array('fat12', 'fat16') as $image) {
+            `cp /tmp/$image.img /tmp/$image-write.img`;
+            `fatcat /tmp/$image-write.img -w 100 -v 2748 -t 2`;
+            `fatcat /tmp/$image-write.img -w 101 -v 291 -t 2`;
+            `fatcat /tmp/$image-write.img -w 341 -v 2748 -t 2`;
+
+            $infos = `fatcat /tmp/$image-write.img -@ 101`;
+            $this->assertContains('FAT1: 0 (00000000)', $infos);
+            $this->assertContains('FAT2: 291 (00000123)', $infos);
+
+            foreach (array(99, 102, 340, 342) as $cluster) {
+                $infos = `fatcat /tmp/$image-write.img -@ $cluster`;
+                $this->assertContains('FAT2: 0 (00000000)', $infos);
+            }
+
+            $infos = `fatcat /tmp/$image-write.img -@ 341`;
+            $this->assertContains('FAT2: 2748 (00000abc)', $infos);
+
+            `fatcat /tmp/$image-write.img -m`;
+            $diff = `fatcat /tmp/$image-write.img -2`;
+            $this->assertContains('FATs are exactly equals', $diff);
+
+            $infos = `fatcat /tmp/$image-write.img -@ 14`;
+            $this->assertContains('FAT1: 16 (00000010)', $infos);
+            $this->assertContains('Chain size: 5', $infos);
+        }
+    }
+
+    /**
+     * Testing changing the size of an entry
+     */
+    public function testEntrySize()
+    {
+        $sum = md5_file('/tmp/hello-world.img');
+
+        `fatcat /tmp/hello-world.img -e /hello.txt -s 5`;
+        $file = `fatcat /tmp/hello-world.img -r /hello.txt`;
+        $this->assertEquals("Hello", $file);
+
+        `fatcat /tmp/hello-world.img -e /hello.txt -s 13`;
+        $this->assertEquals($sum, md5_file('/tmp/hello-world.img'));
+    }
+
+    /**
+     * Testing the decoding of long file names
+     */
+    public function testLongNames()
+    {
+        // The long name part of hello.txt is at offset 823296, its
+        // letters are UTF-16, and its checksum at offset 13
+        copy('/tmp/hello-world.img', '/tmp/long-names.img');
+        $image = fopen('/tmp/long-names.img', 'r+b');
+        fseek($image, 823296+3);
+        fwrite($image, "\xe9\x00\x2d\x4e");
+        fclose($image);
+
+        $listing = `fatcat /tmp/long-names.img -l /`;
+        $this->assertContains("h\xc3\xa9\xe4\xb8\xadlo.txt", $listing);
+
+        $image = fopen('/tmp/long-names.img', 'r+b');
+        fseek($image, 823296+13);
+        fwrite($image, "\x00");
+        fclose($image);
+
+        $listing = `fatcat /tmp/long-names.img -l /`;
+        $this->assertContains('HELLO.TXT', $listing);
+
+        // The two parts of "a long file name.txt" are at offset 42560 of
+        // fat16.img, the last one first; they are swapped and the last one
+        // starts with a non-ASCII letter
+        copy('/tmp/fat16.img', '/tmp/long-names.img');
+        $image = fopen('/tmp/long-names.img', 'r+b');
+        fseek($image, 42560);
+        $parts = fread($image, 64);
+        fseek($image, 42560);
+        fwrite($image, substr($parts, 32, 32).substr($parts, 0, 32));
+        fseek($image, 42560+32+1);
+        fwrite($image, "\xe9\x00");
+        fclose($image);
+
+        $listing = `fatcat /tmp/long-names.img -l /`;
+        $this->assertContains("a long file n\xc3\xa9me.txt", $listing);
     }
 
     /**
@@ -105,6 +638,31 @@ class FatcatTests extends \PHPUnit_Framework_TestCase
         $this->assertEquals("This file was deleted!\n", $file);
     }
 
+    /**
+     * Testing wiping the unallocated clusters
+     */
+    public function testWipe()
+    {
+        copy('/tmp/deleted.img', '/tmp/wipe.img');
+        $wipe = `fatcat /tmp/wipe.img -S`;
+        $this->assertContains('Wiped 100791 sectors', $wipe);
+
+        $file = `fatcat /tmp/wipe.img -r /deleted/file.txt 2>/dev/null`;
+        $this->assertNotContains('This file was deleted', $file);
+
+        copy('/tmp/hello-world.img', '/tmp/wipe.img');
+        `fatcat /tmp/wipe.img -z`;
+        $sum = md5_file('/tmp/wipe.img');
+
+        $file = `fatcat /tmp/wipe.img -r /files/other_file.txt`;
+        $this->assertEquals("Hello!\nThis is another file!\n", $file);
+
+        // Punching holes gives the same data
+        copy('/tmp/hello-world.img', '/tmp/wipe.img');
+        `fatcat /tmp/wipe.img -Z`;
+        $this->assertEquals($sum, md5_file('/tmp/wipe.img'));
+    }
+
     /**
      * Testing backuping & restoring FAT
      */
@@ -0,0 +1,98 @@
+<?php
+/**
+ * Measures the reading speed of a contiguous and of a fragmented file
+ *
+ * Usage: php benchmark.php [fatcat binary] [file size in MB]
+ */
+
+$fatcat = isset($argv[1]) ? $argv[1] : 'fatcat';
+$megabytes = isset($argv[2]) ? intval($argv[2]) : 64;
+$image = '/tmp/benchmark.img';
+
+$bytesPerSector = 512;
+$sectorsPerCluster = 8;
+$reservedSectors = 32;
+$clusterSize = $bytesPerSector*$sectorsPerCluster;
+$fileClusters = $megabytes*1024*1024/$clusterSize;
+
+// Root directory, the contiguous file, then the fragmented one using
+// one cluster out of two
+$totalClusters = 2+1+$fileClusters*3+1024;
+$sectorsPerFat = intval(ceil($totalClusters*4/$bytesPerSector));
+$dataStart = ($reservedSectors+2*$sectorsPerFat)*$bytesPerSector;
+$totalSectors = $dataStart/$bytesPerSector + $totalClusters*$sectorsPerCluster;
+
+function clusterOffset($cluster)
+{
+    global $dataStart, $clusterSize;
+
+    return $dataStart + ($cluster-2)*$clusterSize;
+}
+
+function entry($name, $cluster, $size)
+{
+    return $name . chr(0x20) . str_repeat("\0", 8) . pack('v', $cluster>>16)
+        . str_repeat("\0", 4) . pack('vV', $cluster&0xffff, $size);
+}
+
+echo "Creating $image...\n";
+$f = fopen($image, 'w+');
+ftruncate($f, $totalSectors*$bytesPerSector);
+
+// Boot sector
+$boot = "\xeb\x58\x90" . 'FATCAT  ';
+$boot .= pack('vCvCvvCvvvVV', $bytesPerSector, $sectorsPerCluster, $reservedSectors,
+    2, 0, 0, 0xf8, 0, 32, 64, 0, $totalSectors);
+$boot .= pack('VvvVvv', $sectorsPerFat, 0, 0, 2, 1, 6);
+$boot = str_pad($boot, 0x47, "\0") . 'BENCHMARK  ' . 'FAT32   ';
+$boot = str_pad($boot, 510, "\0") . "\x55\xaa";
+fwrite($f, $boot);
+
+// FAT
+$fat = array_fill(0, $sectorsPerFat*$bytesPerSector/4, 0);
+$fat[0] = 0x0ffffff8;
+$fat[1] = 0x0fffffff;
+$fat[2] = 0x0fffffff;
+$contiguous = 3;
+$fragmented = $contiguous+$fileClusters;
+for ($i=0; $i<$fileClusters; $i++) {
+    $last = ($i == $fileClusters-1);
+    $fat[$contiguous+$i] = $last ? 0x0fffffff : $contiguous+$i+1;
+    $fat[$fragmented+2*$i] = $last ? 0x0fffffff : $fragmented+2*$i+2;
+}
+$table = call_user_func_array('pack', array_merge(array('V*'), $fat));
+fseek($f, $reservedSectors*$bytesPerSector);
+fwrite($f, $table);
+fwrite($f, $table);
+
+// Root directory
+fseek($f, clusterOffset(2));
+fwrite($f, entry('CONTIG  BIN', $contiguous, $fileClusters*$clusterSize));
+fwrite($f, entry('FRAGMENTBIN', $fragmented, $fileClusters*$clusterSize));
+
+// Files data
+$block = substr(str_repeat(sha1('fatcat', true), 1+$clusterSize/20), 0, $clusterSize);
+fseek($f, clusterOffset($contiguous));
+for ($i=0; $i<$fileClusters; $i+=256) {
+    fwrite($f, str_repeat($block, min(256, $fileClusters-$i)));
+}
+for ($i=0; $i<$fileClusters; $i++) {
+    fseek($f, clusterOffset($fragmented+2*$i));
+    fwrite($f, $block);
+}
+fclose($f);
+
+foreach (array('contig.bin', 'fragment.bin') as $file) {
+    $best = null;
+    for ($i=0; $i<3; $i++) {
+        $start = microtime(true);
+        `$fatcat $image -r /$file > /dev/null`;
+        $time = microtime(true)-$start;
+        if ($best === null || $time < $best) {
+            $best = $time;
+        }
+    }
+    printf("%-14s %8.1f MB/s\n", $file, $megabytes/$best);
+}
+
+unlink($image);
@@ -4,7 +4,8 @@
  */
 
 $images = array(
-    'deleted', 'empty', 'hello-world', 'repair'
+    'deleted', 'empty', 'hello-world', 'repair', 'partitions', 'infinite-file',
+    'fat12', 'fat16'
 );
 $directory = __DIR__ . '/../docs/images';
 
@@ -14,3 +15,12 @@ foreach ($images as $image) {
     `cp $directory/$file /tmp`;
     `gunzip -f /tmp/$file`;
 }
+
+/**
+ * Sparse disk of more than 2TB, with a copy of hello-world.img in a
+ * partition starting after the 2TB mark (2TB + 1MB)
+ */
+echo "Creating big-disk.img...\n";
+`rm -f /tmp/big-disk.img`;
+`truncate -s 2300G /tmp/big-disk.img`;
+`dd if=/tmp/hello-world.img of=/tmp/big-disk.img bs=1M seek=2097153 conv=notrunc 2>/dev/null`;
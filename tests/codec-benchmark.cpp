@@ -0,0 +1,138 @@
+/**
+ * Measures the decoding of the FAT entries for each width, comparing a
+ * decoding choosing the width for each entry with the FatCodec ones
+ *
+ * Usage: codec-benchmark [number of entries in millions]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#include <FatUtils.h>
+#include <core/FatCodec.h>
+
+using namespace std;
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Entry of a cluster, the width being only known at run time
+ */
+static uint32_t decodeAny(unsigned int bits, const char *data, unsigned int cluster)
+{
+    if (bits == 32) {
+        uint32_t next = FAT_READ_LONG(data, 4ULL*cluster)&0x0fffffff;
+        return next >= 0x0ffffff0 ? FAT_LAST : next;
+    }
+
+    if (bits == 16) {
+        uint32_t next = FAT_READ_SHORT(data, 2ULL*cluster)&0xffff;
+        return next >= 0xfff0 ? FAT_LAST : next;
+    }
+
+    uint32_t next = FAT_READ_SHORT(data, cluster+cluster/2ULL);
+    if (cluster&1) {
+        next >>= 4;
+    }
+    next &= 0xfff;
+    return next >= 0xff0 ? FAT_LAST : next;
+}
+
+static uint64_t sumAny(unsigned int bits, const char *data, unsigned int count)
+{
+    uint64_t sum = 0;
+    for (unsigned int cluster=0; cluster<count; cluster++) {
+        sum += decodeAny(bits, data, cluster);
+    }
+
+    return sum;
+}
+
+template<int Bits>
+static uint64_t sumEntries(const char *data, unsigned int count)
+{
+    uint64_t sum = 0;
+    for (unsigned int cluster=0; cluster<count; cluster++) {
+        const char *entry = data+FatCodec<Bits>::offset(cluster);
+        sum += FatCodec<Bits>::decodeValue(FatCodec<Bits>::get(entry, cluster));
+    }
+
+    return sum;
+}
+
+template<int Bits>
+static uint64_t sumDecoded(const char *data, unsigned int count)
+{
+    uint64_t sum = 0;
+    vector<uint32_t> values(FAT_CODEC_CHUNK);
+
+    for (unsigned int cluster=0; cluster<count; cluster+=FAT_CODEC_CHUNK) {
+        unsigned int n = count-cluster < FAT_CODEC_CHUNK ? count-cluster : FAT_CODEC_CHUNK;
+        FatCodec<Bits>::decode(data+FatCodec<Bits>::offset(cluster), &values[0], n);
+
+        // Summed apart, so that the total stays in a register
+        uint64_t chunk = 0;
+        for (unsigned int i=0; i<n; i++) {
+            chunk += values[i];
+        }
+        sum += chunk;
+    }
+
+    return sum;
+}
+
+// Not known by the compiler, as for a FatSystem
+static volatile unsigned int bits;
+
+template<int Bits>
+static bool run(unsigned int count)
+{
+    vector<char> data(FatCodec<Bits>::offset(count)+4);
+    srand(42);
+    for (size_t i=0; i<data.size(); i++) {
+        data[i] = rand();
+    }
+
+    const char *names[] = {"per entry", "FatCodec get", "FatCodec decode"};
+    uint64_t sums[3];
+
+    for (int method=0; method<3; method++) {
+        double best = 0;
+
+        for (int i=0; i<3; i++) {
+            double start = now();
+            if (method == 0) {
+                bits = Bits;
+                sums[method] = sumAny(bits, &data[0], count);
+            } else if (method == 1) {
+                sums[method] = sumEntries<Bits>(&data[0], count);
+            } else {
+                sums[method] = sumDecoded<Bits>(&data[0], count);
+            }
+            double time = now()-start;
+
+            if (i == 0 || time < best) {
+                best = time;
+            }
+        }
+        printf("FAT%-2d %-16s %8.1f M entries/s\n", Bits, names[method], count/best/1e6);
+    }
+
+    return sums[0] == sums[1] && sums[1] == sums[2];
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int count = (argc > 1 ? atoi(argv[1]) : 64)*1000000;
+
+    if (!run<12>(count) || !run<16>(count) || !run<32>(count)) {
+        printf("Results differ\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
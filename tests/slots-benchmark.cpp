@@ -0,0 +1,126 @@
+/**
+ * Measures the classification of directory slots, comparing the checks
+ * done on each FatEntry with the scalar and vectorized FatSlots
+ *
+ * Usage: slots-benchmark [data size in MB]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include <core/FatEntry.h>
+#include <core/FatSlots.h>
+
+using namespace std;
+
+// Size of the classified groups, a 512 bytes sector
+#define SLOTS   16
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Slots of a damaged data area: entries, long names, zero and garbage
+ */
+static void generate(vector<char> &data)
+{
+    srand(42);
+
+    for (size_t offset=0; offset+FAT_ENTRY_SIZE<=data.size(); offset+=FAT_ENTRY_SIZE) {
+        char *slot = &data[offset];
+        int kind = rand()%4;
+
+        if (kind == 0) {
+            memcpy(slot, "FILE    TXT", 11);
+            slot[FAT_ATTRIBUTES] = FAT_ATTRIBUTES_FILE;
+            slot[FAT_CLUSTER_LOW] = rand()%100;
+        } else if (kind == 1) {
+            slot[0] = 0x41;
+            slot[1] = 'a';
+            slot[FAT_ATTRIBUTES] = FAT_ATTRIBUTES_LONGFILE;
+        } else if (kind == 3) {
+            for (int i=0; i<FAT_ENTRY_SIZE; i++) {
+                slot[i] = rand();
+            }
+        }
+    }
+}
+
+/**
+ * Number of slots looking like entries, decoding each of them
+ */
+static unsigned long long countEntries(vector<char> &data)
+{
+    unsigned long long found = 0;
+
+    for (size_t offset=0; offset+FAT_ENTRY_SIZE<=data.size(); offset+=FAT_ENTRY_SIZE) {
+        const char *slot = &data[offset];
+
+        if (slot[FAT_ATTRIBUTES] != FAT_ATTRIBUTES_LONGFILE) {
+            FatEntry entry;
+            entry.setData(slot);
+
+            if (!entry.isZero() && entry.isCorrect()) {
+                found++;
+            }
+        }
+    }
+
+    return found;
+}
+
+static unsigned long long countSlots(vector<char> &data, bool scalar)
+{
+    unsigned long long found = 0;
+    FatSlots slots;
+
+    for (size_t offset=0; offset+SLOTS*FAT_ENTRY_SIZE<=data.size(); offset+=SLOTS*FAT_ENTRY_SIZE) {
+        if (scalar) {
+            slots.classifyScalar(&data[offset], SLOTS);
+        } else {
+            slots.classify(&data[offset], SLOTS);
+        }
+
+        found += __builtin_popcountll(slots.entry[0]);
+    }
+
+    return found;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long megabytes = argc > 1 ? atoi(argv[1]) : 64;
+    vector<char> data(megabytes*1024*1024);
+    generate(data);
+
+    const char *names[] = {"FatEntry", "FatSlots scalar", "FatSlots"};
+    unsigned long long counts[3];
+
+    for (int method=0; method<3; method++) {
+        double best = 0;
+
+        for (int i=0; i<3; i++) {
+            double start = now();
+            counts[method] = method == 0 ? countEntries(data) : countSlots(data, method == 1);
+            double time = now()-start;
+
+            if (i == 0 || time < best) {
+                best = time;
+            }
+        }
+        printf("%-16s %8.1f MB/s (%llu entries)\n", names[method], megabytes/best, counts[method]);
+    }
+
+    // The entries not passing the other checks of isCorrect() are also
+    // found by FatSlots, but the generated ones all do
+    if (counts[0] != counts[1] || counts[1] != counts[2]) {
+        printf("Results differ\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}